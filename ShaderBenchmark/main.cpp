@@ -0,0 +1,389 @@
+﻿#include "pch.h"
+#include "ShaderGenerator.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace ShaderGenerator;
+
+//Cached lookups are too fast to time each of them, only every this many is timed
+const uint64_t LookupSampleInterval = 64;
+
+struct BenchmarkArguments
+{
+  string Input;
+  unsigned MaxThreadCount = max(thread::hardware_concurrency(), 1u);
+  unsigned Duration = 1000;
+  CompiledShaderCacheLimits CacheLimits;
+  string Report;
+
+  static BenchmarkArguments Parse(int argc, char* argv[])
+  {
+    BenchmarkArguments result;
+
+    regex regex("-(\\w+)(?:=(.*))?");
+    for (auto i = 1; i < argc; i++)
+    {
+      cmatch match;
+      if (!regex_match(argv[i], match, regex)) throw runtime_error("Invalid argument: "s + argv[i]);
+
+      auto key = match[1].str();
+      auto value = match[2].str();
+      if (key == "i") result.Input = value;
+      else if (key == "t") result.MaxThreadCount = max(unsigned(stoul(value)), 1u);
+      else if (key == "d") result.Duration = unsigned(stoul(value));
+      else if (key == "b") result.CacheLimits.BlockCount = stoull(value);
+      else if (key == "m") result.CacheLimits.ByteBudget = stoull(value) * 1024 * 1024;
+      else if (key == "r") result.Report = value;
+      else throw runtime_error("Unknown argument: "s + argv[i]);
+    }
+
+    if (result.Input.empty()) throw runtime_error("No input shader group specified.");
+    return result;
+  }
+};
+
+struct BenchmarkRun
+{
+  unsigned ThreadCount;
+  double ColdTime, ColdShaderRate, ColdByteRate, LookupRate, Scaling;
+
+  //Latencies in seconds, sorted
+  vector<double> ColdLatencies, LookupLatencies;
+
+  uint64_t PeakMemory;
+};
+
+//Nearest rank percentile of sorted values
+double Percentile(const vector<double>& values, double percentile)
+{
+  if (values.empty()) return 0.0;
+
+  auto rank = size_t(ceil(percentile * values.size()));
+  return values[clamp<size_t>(rank, 1, values.size()) - 1];
+}
+
+//Returns the largest amount of memory the process had resident so far in bytes
+uint64_t GetPeakMemoryUsage()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{};
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0ull;
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0ull;
+  return uint64_t(usage.ru_maxrss) * 1024ull;
+#endif
+}
+
+//Merges the latencies collected by each thread
+vector<double> MergeLatencies(vector<vector<double>>&& threadLatencies)
+{
+  vector<double> result;
+  for (auto& latencies : threadLatencies)
+  {
+    result.insert(result.end(), latencies.begin(), latencies.end());
+  }
+
+  sort(result.begin(), result.end());
+  return result;
+}
+
+string CreateReport(const BenchmarkArguments& arguments, size_t shaderCount, const char* lz4Decoder, const vector<BenchmarkRun>& runs)
+{
+  //Paths may hold backslashes
+  string input;
+  for (auto character : arguments.Input)
+  {
+    if (character == '\\' || character == '"') input += '\\';
+    input += character;
+  }
+
+  stringstream result;
+  result << "{\n  \"group\": { \"path\": \"" << input << "\", \"shaders\": " << shaderCount << ", \"lz4_decoder\": \"" << lz4Decoder << "\" },\n";
+  result << "  \"runs\": [\n";
+  for (size_t i = 0; i < runs.size(); i++)
+  {
+    auto& run = runs[i];
+    result << "    { ";
+    result << "\"threads\": " << run.ThreadCount << ", ";
+    result << "\"cold_ms\": " << run.ColdTime * 1000.0 << ", ";
+    result << "\"cold_shaders_per_second\": " << run.ColdShaderRate << ", ";
+    result << "\"cold_megabytes_per_second\": " << run.ColdByteRate / (1024.0 * 1024.0) << ", ";
+    result << "\"cold_p50_us\": " << Percentile(run.ColdLatencies, 0.5) * 1e6 << ", ";
+    result << "\"cold_p90_us\": " << Percentile(run.ColdLatencies, 0.9) * 1e6 << ", ";
+    result << "\"cold_p99_us\": " << Percentile(run.ColdLatencies, 0.99) * 1e6 << ", ";
+    result << "\"cold_max_us\": " << Percentile(run.ColdLatencies, 1.0) * 1e6 << ", ";
+    result << "\"cached_lookups_per_second\": " << run.LookupRate << ", ";
+    result << "\"cached_p50_ns\": " << Percentile(run.LookupLatencies, 0.5) * 1e9 << ", ";
+    result << "\"cached_p90_ns\": " << Percentile(run.LookupLatencies, 0.9) * 1e9 << ", ";
+    result << "\"cached_p99_ns\": " << Percentile(run.LookupLatencies, 0.99) * 1e9 << ", ";
+    result << "\"cached_max_ns\": " << Percentile(run.LookupLatencies, 1.0) * 1e9 << ", ";
+    result << "\"scaling\": " << run.Scaling << ", ";
+    result << "\"peak_memory_megabytes\": " << run.PeakMemory / (1024.0 * 1024.0);
+    result << " }" << (i + 1 < runs.size() ? "," : "") << "\n";
+  }
+  result << "  ]\n}\n";
+  return result.str();
+}
+
+//Loads every shader with a single block cached and again with every block cached, returns the decompressed size of the group
+//Blocks kept alive by cached shaders must be reused, so both load the same bytes even though the first evicts blocks all the time
+size_t CheckBlockReuse(CompiledShaderGroup& group, const vector<uint64_t>& keys, const CompiledShaderCacheLimits& cacheLimits)
+{
+  auto shuffledKeys = keys;
+  shuffle(shuffledKeys.begin(), shuffledKeys.end(), mt19937_64{ 0 });
+
+  auto loadAll = [&](const vector<uint64_t>& orderedKeys, size_t blockCount) {
+    group.ClearCache();
+    group.CacheLimits({ blockCount, 0 });
+
+    for (auto key : orderedKeys)
+    {
+      group.Shader(key);
+    }
+    return group.CacheSize();
+  };
+
+  auto groupSize = loadAll(keys, keys.size());
+  auto evictingSize = loadAll(shuffledKeys, 1);
+
+  group.ClearCache();
+  group.CacheLimits(cacheLimits);
+
+  printf("Block reuse: %.1f KB decompressed in key order, %.1f KB in random order with a single cached block\n", groupSize / 1024.0, evictingSize / 1024.0);
+  if (evictingSize != groupSize) throw runtime_error("Blocks kept alive by cached shaders are decompressed again.");
+  return groupSize;
+}
+
+//Loads every shader once in the given order and checks that the buffers they keep alive are counted in the cache size and fit into the budget
+//Only weak references are held, so whatever is still resident afterwards is kept by the cache itself
+//A budget holding the whole group must keep every shader cached, so loading them again returns the same shaders
+void CheckCacheBudget(CompiledShaderGroup& group, const vector<uint64_t>& orderedKeys, const char* orderName, size_t byteBudget, size_t groupSize)
+{
+  struct storage_usage
+  {
+    weak_ptr<const void> Storage;
+    const uint8_t* Begin = nullptr;
+    const uint8_t* End = nullptr;
+  };
+
+  group.ClearCache();
+
+  unordered_map<const void*, storage_usage> storages;
+  vector<weak_ptr<const CompiledShader>> shaders;
+  shaders.reserve(orderedKeys.size());
+  for (auto key : orderedKeys)
+  {
+    auto shader = group.Shader(key);
+    shaders.push_back(shader);
+    if (!shader) continue;
+
+    //Shaders sharing a storage point into the same buffer, so the range they cover is part of it
+    auto& usage = storages[shader->Storage.get()];
+    auto begin = shader->ByteCode.data(), end = begin + shader->ByteCode.size();
+    if (usage.Storage.expired()) usage = { shader->Storage, begin, end };
+    usage.Begin = min(usage.Begin, begin);
+    usage.End = max(usage.End, end);
+  }
+
+  //The ranges still kept alive are a lower bound of the resident bytes
+  uint64_t residentSize = 0;
+  for (auto& [storage, usage] : storages)
+  {
+    if (!usage.Storage.expired()) residentSize += usage.End - usage.Begin;
+  }
+
+  auto cacheSize = group.CacheSize();
+  printf("Cache budget in %s order: at least %.1f KB resident, %.1f KB counted, %.1f KB allowed\n", orderName, residentSize / 1024.0, cacheSize / 1024.0, byteBudget / 1024.0);
+
+  if (cacheSize > byteBudget) throw runtime_error("The cache holds more than its byte budget.");
+  if (residentSize > cacheSize) throw runtime_error("The cache keeps more bytes resident than it counts.");
+
+  if (byteBudget < groupSize) return;
+  for (size_t i = 0; i < orderedKeys.size(); i++)
+  {
+    if (group.Shader(orderedKeys[i]) != shaders[i].lock()) throw runtime_error("The cache evicts shaders although the whole group fits into its budget.");
+  }
+}
+
+//Runs the action on the specified number of threads at once and returns the elapsed time
+template<typename TAction>
+double RunThreads(unsigned threadCount, TAction&& action)
+{
+  atomic<unsigned> readyCount = 0;
+  vector<thread> threads;
+  threads.reserve(threadCount);
+
+  auto start = steady_clock::now();
+  for (auto i = 0u; i < threadCount; i++)
+  {
+    threads.emplace_back([&, i] {
+      //Start together, so the first threads do not finish before the last ones are created
+      readyCount++;
+      while (readyCount < threadCount) this_thread::yield();
+
+      action(i);
+    });
+  }
+
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printf("Shader Benchmark\n");
+    printf("\n");
+
+    printf("Usage:\n");
+    printf("  -i=<file_path>: Path of the compiled shader group\n");
+    printf("  -t=<count>: Maximum number of threads - default is the number of hardware threads\n");
+    printf("  -d=<ms>: Duration of each cached lookup run - default is 1000\n");
+    printf("  -b=<count>: Number of decompressed blocks kept - default is 4\n");
+    printf("  -m=<size_mb>: Cache byte budget in megabytes - default is unlimited\n");
+    printf("  -r=<file_path>: Path of a JSON report of the results\n");
+    return 0;
+  }
+
+  try
+  {
+    auto arguments = BenchmarkArguments::Parse(argc, argv);
+
+    auto group = CompiledShaderGroup::FromFile(arguments.Input, arguments.CacheLimits);
+    auto keys = group.Keys();
+    if (keys.empty()) throw runtime_error("The shader group is empty.");
+
+#ifdef SHADERGENERATOR_HAS_LZ4
+    auto lz4Decoder = "library";
+#else
+    auto lz4Decoder = "built-in";
+#endif
+
+    printf("%s: %zu shaders, %s LZ4 decoder\n\n", arguments.Input.c_str(), keys.size(), lz4Decoder);
+    if (arguments.CacheLimits.ByteBudget)
+    {
+      auto groupSize = CheckBlockReuse(group, keys, arguments.CacheLimits);
+
+      //Random order, so the shaders left in the cache come from many blocks
+      auto shuffledKeys = keys;
+      shuffle(shuffledKeys.begin(), shuffledKeys.end(), mt19937_64{ 0 });
+
+      CheckCacheBudget(group, keys, "key", arguments.CacheLimits.ByteBudget, groupSize);
+      CheckCacheBudget(group, shuffledKeys, "random", arguments.CacheLimits.ByteBudget, groupSize);
+      printf("\n");
+    }
+
+    printf("threads  cold ms  cold shaders/s  cold MB/s  cold p50 us  cold p99 us  cached lookups/s  cached p99 ns  scaling  peak MB\n");
+
+    //Powers of two up to the maximum thread count
+    vector<unsigned> threadCounts;
+    for (auto threadCount = 1u; threadCount < arguments.MaxThreadCount; threadCount *= 2)
+    {
+      threadCounts.push_back(threadCount);
+    }
+    threadCounts.push_back(arguments.MaxThreadCount);
+
+    double baseLookupRate = 0.0;
+    vector<BenchmarkRun> runs;
+    for (auto threadCount : threadCounts)
+    {
+      //Cold loads: each thread loads a contiguous range of keys, so they mostly decompress different blocks
+      group.ClearCache();
+
+      //The throughput is measured in decompressed bytecode
+      atomic<size_t> missingCount = 0;
+      atomic<uint64_t> coldSize = 0;
+      vector<vector<double>> coldLatencies(threadCount);
+      auto coldTime = RunThreads(threadCount, [&](unsigned index) {
+        auto first = keys.size() * index / threadCount;
+        auto last = keys.size() * (index + 1) / threadCount;
+
+        uint64_t size = 0;
+        auto& latencies = coldLatencies[index];
+        latencies.reserve(last - first);
+        for (auto i = first; i < last; i++)
+        {
+          auto start = steady_clock::now();
+          auto shader = group.Shader(keys[i]);
+          latencies.push_back(duration<double>(steady_clock::now() - start).count());
+
+          if (shader) size += shader->ByteCode.size();
+          else missingCount++;
+        }
+        coldSize += size;
+      });
+
+      //Cached lookups: random keys, most of them hit the cache filled above
+      atomic<uint64_t> lookupCount = 0;
+      vector<vector<double>> lookupLatencies(threadCount);
+      auto lookupTime = RunThreads(threadCount, [&](unsigned index) {
+        mt19937_64 random{ index };
+        uniform_int_distribution<size_t> distribution{ 0, keys.size() - 1 };
+
+        uint64_t count = 0;
+        auto end = steady_clock::now() + milliseconds(arguments.Duration);
+        while (steady_clock::now() < end)
+        {
+          for (auto i = 0; i < 1024; i++)
+          {
+            auto key = keys[distribution(random)];
+            if (i % LookupSampleInterval == 0)
+            {
+              auto start = steady_clock::now();
+              auto shader = group.Shader(key);
+              lookupLatencies[index].push_back(duration<double>(steady_clock::now() - start).count());
+              if (!shader) missingCount++;
+            }
+            else if (!group.Shader(key))
+            {
+              missingCount++;
+            }
+          }
+          count += 1024;
+        }
+        lookupCount += count;
+      });
+
+      if (missingCount) throw runtime_error("Failed to load " + to_string(missingCount) + " shaders.");
+
+      auto lookupRate = lookupCount / lookupTime;
+      if (threadCount == 1) baseLookupRate = lookupRate;
+
+      BenchmarkRun run{ threadCount, coldTime, keys.size() / coldTime, coldSize / coldTime, lookupRate, lookupRate / baseLookupRate, MergeLatencies(move(coldLatencies)), MergeLatencies(move(lookupLatencies)), GetPeakMemoryUsage() };
+      printf("%7u  %7.1f  %14.0f  %9.1f  %11.1f  %11.1f  %16.0f  %13.0f  %6.2fx  %7.1f\n",
+        run.ThreadCount,
+        run.ColdTime * 1000.0,
+        run.ColdShaderRate,
+        run.ColdByteRate / (1024.0 * 1024.0),
+        Percentile(run.ColdLatencies, 0.5) * 1e6,
+        Percentile(run.ColdLatencies, 0.99) * 1e6,
+        run.LookupRate,
+        Percentile(run.LookupLatencies, 0.99) * 1e9,
+        run.Scaling,
+        run.PeakMemory / (1024.0 * 1024.0));
+      runs.push_back(move(run));
+    }
+
+    if (!arguments.Report.empty())
+    {
+      ofstream report(arguments.Report, ios::out | ios::binary);
+      report << CreateReport(arguments, keys.size(), lz4Decoder, runs);
+      if (!report.good()) throw runtime_error("Failed to write report " + arguments.Report + ".");
+      printf("Report saved to %s.\n", arguments.Report.c_str());
+    }
+
+    return 0;
+  }
+  catch (const exception& error)
+  {
+    printf("%s\n", error.what());
+    return -1;
+  }
+}
@@ -0,0 +1,24 @@
+﻿#pragma once
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <regex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment (lib, "Psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "Benchmark.h"
+#include "Profiler.h"
+#include "ShaderConfiguration.h"
+#include "ShaderGroupBuilder.h"
+#include "Parallel.h"
+#include "IO.h"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  //Permutation and scheduling take little time, so they are repeated to collect enough samples
+  const size_t BenchmarkRepeatCount = 20;
+
+  struct BenchmarkStage
+  {
+    string Name;
+
+    //Durations of the samples in seconds, sorted
+    vector<double> Latencies;
+
+    //Number of variants or blocks processed, and their bytes
+    uint64_t Items = 0ull;
+    uint64_t Bytes = 0ull;
+
+    //Peak resident memory of the process once the stage completed
+    uint64_t PeakMemory = 0ull;
+
+    //Time spent in the samples, summed over the threads for the stages running in parallel
+    double Time() const
+    {
+      return accumulate(Latencies.begin(), Latencies.end(), 0.0);
+    }
+
+    //Nearest rank percentile
+    double Percentile(double percentile) const
+    {
+      if (Latencies.empty()) return 0.0;
+
+      auto rank = size_t(ceil(percentile * Latencies.size()));
+      return Latencies[clamp<size_t>(rank, 1, Latencies.size()) - 1];
+    }
+  };
+
+  //Parses comma separated terms of <value_count> or <option_count>x<value_count>
+  static vector<size_t> ParseOptionLayout(const string& text)
+  {
+    static regex termRegex("(\\d+)(?:x(\\d+))?");
+
+    vector<size_t> results;
+    stringstream stream{ text };
+    string term;
+    while (getline(stream, term, ','))
+    {
+      smatch match;
+      if (!regex_match(term, match, termRegex)) throw runtime_error("Invalid benchmark option layout: " + text);
+
+      auto optionCount = match[2].matched ? stoull(match[1]) : 1ull;
+      auto valueCount = stoull(match[2].matched ? match[2] : match[1]);
+      if (valueCount == 0) throw runtime_error("Benchmark options need at least one value: " + text);
+
+      results.insert(results.end(), size_t(optionCount), size_t(valueCount));
+    }
+
+    if (results.empty()) throw runtime_error("Invalid benchmark option layout: " + text);
+    return results;
+  }
+
+  static string CreateSource(const vector<size_t>& valueCounts)
+  {
+    string result = "//Synthetic shader group of the benchmark mode\n#pragma target cs_5_0\n";
+    for (size_t i = 0; i < valueCounts.size(); i++)
+    {
+      result += "#pragma option uint Option" + to_string(i) + " {0.." + to_string(valueCounts[i] - 1) + "}\n";
+    }
+
+    //Every option is used by the code, otherwise its variants would be compiled only once
+    result += "\nRWStructuredBuffer<uint> Output : register(u0);\n\n[numthreads(64, 1, 1)]\nvoid main(uint3 id : SV_DispatchThreadID)\n{\n  uint value = id.x;\n";
+    for (size_t i = 0; i < valueCounts.size(); i++)
+    {
+      result += "  value = value * 31 + Option" + to_string(i) + ";\n";
+    }
+
+    result += "  Output[id.x] = value;\n}\n";
+    return result;
+  }
+
+  template<typename TAction>
+  static BenchmarkStage MeasureStage(const char* name, size_t itemCount, TAction&& action)
+  {
+    BenchmarkStage result{ name, {}, 0ull, 0ull, 0ull };
+    for (size_t i = 0; i < BenchmarkRepeatCount; i++)
+    {
+      auto start = steady_clock::now();
+      action();
+      result.Latencies.push_back(duration<double>(steady_clock::now() - start).count());
+    }
+
+    sort(result.Latencies.begin(), result.Latencies.end());
+    result.Items = uint64_t(itemCount) * BenchmarkRepeatCount;
+    result.PeakMemory = get_peak_memory_usage();
+    return result;
+  }
+
+  static string CreateReport(const ShaderCompilationArguments& arguments, const vector<size_t>& valueCounts, size_t variantCount, const vector<BenchmarkStage>& stages)
+  {
+    stringstream result;
+    result << "{\n  \"group\": {\n    \"options\": [";
+    for (size_t i = 0; i < valueCounts.size(); i++)
+    {
+      result << (i ? ", " : "") << valueCounts[i];
+    }
+    result << "],\n";
+    result << "    \"variants\": " << variantCount << ",\n";
+    result << "    \"backend\": \"" << EscapeJson(arguments.Backend) << "\",\n";
+    result << "    \"codec\": \"" << GetBlockCodecName(arguments.Compression.ContainerCodec()) << "\",\n";
+    result << "    \"dictionary_size\": " << arguments.Compression.DictionarySize << ",\n";
+    result << "    \"block_size\": " << arguments.Layout.BlockSize << ",\n";
+    result << "    \"threads\": " << thread_pool::shared().thread_count() << "\n";
+    result << "  },\n  \"stages\": [\n";
+
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+      auto& stage = stages[i];
+      auto time = stage.Time();
+
+      result << "    { ";
+      result << "\"name\": \"" << stage.Name << "\", ";
+      result << "\"samples\": " << stage.Latencies.size() << ", ";
+      result << "\"items\": " << stage.Items << ", ";
+      result << "\"bytes\": " << stage.Bytes << ", ";
+      result << "\"time_ms\": " << time * 1000.0 << ", ";
+      result << "\"items_per_second\": " << (time > 0.0 ? stage.Items / time : 0.0) << ", ";
+      result << "\"megabytes_per_second\": " << (time > 0.0 ? stage.Bytes / time / (1024.0 * 1024.0) : 0.0) << ", ";
+      result << "\"p50_ms\": " << stage.Percentile(0.5) * 1000.0 << ", ";
+      result << "\"p90_ms\": " << stage.Percentile(0.9) * 1000.0 << ", ";
+      result << "\"p99_ms\": " << stage.Percentile(0.99) * 1000.0 << ", ";
+      result << "\"max_ms\": " << stage.Percentile(1.0) * 1000.0 << ", ";
+      result << "\"peak_memory_megabytes\": " << stage.PeakMemory / (1024.0 * 1024.0);
+      result << " }" << (i + 1 < stages.size() ? "," : "") << "\n";
+    }
+
+    result << "  ]\n}\n";
+    return result.str();
+  }
+
+  void RunBenchmark(const ShaderCompilationArguments& arguments)
+  {
+    auto valueCounts = ParseOptionLayout(arguments.Benchmark);
+
+    //The synthetic group is written next to its output, the compilation cache is not used so every variant is compiled
+    auto directory = arguments.Output.empty() ? temp_directory_path() / "ShaderGeneratorBenchmark" : arguments.Output.parent_path();
+    create_directories(directory);
+
+    auto groupArguments = arguments;
+    groupArguments.Input = directory / "Benchmark.hlsl";
+    groupArguments.Output = directory / "Benchmark.csg";
+    groupArguments.Header.clear();
+    groupArguments.IsCacheEnabled = false;
+    if (groupArguments.Backend.empty()) groupArguments.Backend = "fake";
+
+    if (!WriteAllText(groupArguments.Input, CreateSource(valueCounts))) throw runtime_error("Failed to write benchmark source " + groupArguments.Input.string() + ".");
+    auto shader = ShaderInfo::FromFile(groupArguments.Input);
+
+    //Stages measured on their own
+    vector<BenchmarkStage> stages;
+    auto permutations = ShaderOption::Permutate(shader.Options, shader.Constraints);
+    printf("Benchmarking %zu shader variants...\n", permutations.size());
+
+    stages.push_back(MeasureStage("permutate", permutations.size(), [&] {
+      ShaderOption::Permutate(shader.Options, shader.Constraints);
+    }));
+
+    stages.push_back(MeasureStage("parallel_map", permutations.size(), [&] {
+      parallel_map<OptionPermutation, uint64_t>(permutations, [](const OptionPermutation& permutation) { return permutation.Key; });
+    }));
+
+    //Stages of a complete build, measured by the profiler
+    stage_profiler profiler{ !arguments.Trace.empty() };
+    stage_profiler::install(&profiler);
+
+    try
+    {
+      if (!BuildShaderGroup(groupArguments, shader, nullptr, true)) throw runtime_error("The benchmark shader group failed to compile.");
+    }
+    catch (...)
+    {
+      stage_profiler::install(nullptr);
+      throw;
+    }
+    stage_profiler::install(nullptr);
+
+    auto peakMemory = get_peak_memory_usage();
+    for (auto& profiledStage : profiler.stages())
+    {
+      //The permutation of the build is already measured above
+      if (any_of(stages.begin(), stages.end(), [&](const BenchmarkStage& stage) { return stage.Name == profiledStage.name; })) continue;
+
+      BenchmarkStage stage{ profiledStage.name, {}, 0ull, 0ull, 0ull };
+      for (auto& sample : profiledStage.durations)
+      {
+        stage.Latencies.push_back(duration<double>(sample).count());
+      }
+      sort(stage.Latencies.begin(), stage.Latencies.end());
+
+      stage.Items = stage.Latencies.size();
+      stage.Bytes = profiledStage.bytes;
+      stage.PeakMemory = peakMemory;
+
+      //The whole build is reported in variants and output bytes
+      if (stage.Name == "build")
+      {
+        stage.Items = permutations.size();
+        stage.Bytes = file_size(groupArguments.Output);
+      }
+      stages.push_back(move(stage));
+    }
+
+    //Stages running in parallel report their throughput per thread
+    printf("\nstage            samples      items/s     MB/s    p50 ms    p90 ms    p99 ms    max ms  peak MB\n");
+    for (auto& stage : stages)
+    {
+      auto time = stage.Time();
+      printf("%-14s  %8zu  %11.0f  %7.1f  %8.3f  %8.3f  %8.3f  %8.3f  %7.1f\n",
+        stage.Name.c_str(),
+        stage.Latencies.size(),
+        time > 0.0 ? stage.Items / time : 0.0,
+        time > 0.0 ? stage.Bytes / time / (1024.0 * 1024.0) : 0.0,
+        stage.Percentile(0.5) * 1000.0,
+        stage.Percentile(0.9) * 1000.0,
+        stage.Percentile(0.99) * 1000.0,
+        stage.Percentile(1.0) * 1000.0,
+        stage.PeakMemory / (1024.0 * 1024.0));
+    }
+
+    if (!arguments.Trace.empty())
+    {
+      profiler.write_trace(arguments.Trace);
+      profiler.print_summary();
+    }
+
+    if (!arguments.Report.empty())
+    {
+      if (!WriteAllText(arguments.Report, CreateReport(groupArguments, valueCounts, permutations.size(), stages))) throw runtime_error("Failed to write benchmark report " + arguments.Report.string() + ".");
+      printf("Benchmark report saved to %s.\n", arguments.Report.string().c_str());
+    }
+  }
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "ShaderCompilationArguments.h"
+
+namespace ShaderGenerator
+{
+  //Builds a synthetic shader group with the options described by the arguments, then reports the throughput, latency and memory use of each stage
+  void RunBenchmark(const ShaderCompilationArguments& arguments);
+}
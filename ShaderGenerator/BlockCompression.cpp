@@ -0,0 +1,363 @@
+#include "pch.h"
+#include "BlockCompression.h"
+
+using namespace std;
+
+namespace ShaderGenerator
+{
+#ifdef _WIN32
+  struct compressor_handle_traits
+  {
+    using type = COMPRESSOR_HANDLE;
+
+    static void close(type value) noexcept
+    {
+      CloseCompressor(value);
+    }
+
+    static type invalid() noexcept
+    {
+      return nullptr;
+    }
+  };
+
+  static void CompressLzms(span<const uint8_t> input, vector<uint8_t>& output)
+  {
+    //Compressors are expensive to create, each thread keeps its own
+    thread_local winrt::handle_type<compressor_handle_traits> compressor;
+    if (!compressor) winrt::check_bool(CreateCompressor(COMPRESS_ALGORITHM_LZMS, nullptr, compressor.put()));
+
+    //Query the worst case size first
+    SIZE_T compressedLength = 0;
+    if (!Compress(compressor.get(), input.data(), input.size(), nullptr, 0, &compressedLength) && GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    {
+      winrt::throw_last_error();
+    }
+
+    output.resize(compressedLength);
+    winrt::check_bool(Compress(compressor.get(), input.data(), input.size(), output.data(), output.size(), &compressedLength));
+    output.resize(compressedLength);
+  }
+#endif
+
+#ifdef SHADERGENERATOR_HAS_LZ4
+  static void CompressLz4(span<const uint8_t> input, int level, vector<uint8_t>& output)
+  {
+    if (input.size() > LZ4_MAX_INPUT_SIZE) throw runtime_error("Shader block is too large for LZ4 compression.");
+
+    output.resize(LZ4_compressBound(int(input.size())));
+
+    auto source = reinterpret_cast<const char*>(input.data());
+    auto target = reinterpret_cast<char*>(output.data());
+    auto compressedLength = level > 0 ?
+      LZ4_compress_HC(source, target, int(input.size()), int(output.size()), level) :
+      LZ4_compress_default(source, target, int(input.size()), int(output.size()));
+    if (compressedLength <= 0) throw runtime_error("LZ4 compression failed.");
+
+    output.resize(compressedLength);
+  }
+#endif
+
+#ifdef SHADERGENERATOR_HAS_ZSTD
+  struct zstd_context_deleter
+  {
+    void operator()(ZSTD_CCtx* context) const noexcept
+    {
+      ZSTD_freeCCtx(context);
+    }
+  };
+
+  static void CompressZstd(span<const uint8_t> input, int level, vector<uint8_t>& output)
+  {
+    //Contexts keep their allocations between blocks, each thread keeps its own
+    thread_local unique_ptr<ZSTD_CCtx, zstd_context_deleter> context{ ZSTD_createCCtx() };
+
+    output.resize(ZSTD_compressBound(input.size()));
+    auto compressedLength = ZSTD_compressCCtx(context.get(), output.data(), output.size(), input.data(), input.size(), level ? level : ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(compressedLength)) throw runtime_error(string("Zstandard compression failed: ") + ZSTD_getErrorName(compressedLength));
+
+    output.resize(compressedLength);
+  }
+#endif
+
+  bool IsBlockCodecAvailable(BlockCodec codec)
+  {
+    switch (codec)
+    {
+    case BlockCodec::Stored:
+      return true;
+#ifdef _WIN32
+    case BlockCodec::Lzms:
+      return true;
+#endif
+#ifdef SHADERGENERATOR_HAS_LZ4
+    case BlockCodec::Lz4:
+      return true;
+#endif
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    case BlockCodec::Zstd:
+      return true;
+#endif
+    default:
+      return false;
+    }
+  }
+
+  const char* GetBlockCodecName(BlockCodec codec)
+  {
+    switch (codec)
+    {
+    case BlockCodec::Stored:
+      return "stored";
+    case BlockCodec::Lzms:
+      return "lzms";
+    case BlockCodec::Lz4:
+      return "lz4";
+    case BlockCodec::Zstd:
+      return "zstd";
+    case BlockCodec::Lz4Frames:
+      return "lz4 frames";
+    case BlockCodec::ZstdFrames:
+      return "zstd frames";
+    default:
+      return "unknown";
+    }
+  }
+
+  BlockCodec DefaultBlockCodec()
+  {
+    //LZMS stays the default on Windows, so existing loaders can read the output
+    for (auto codec : { BlockCodec::Lzms, BlockCodec::Zstd, BlockCodec::Lz4 })
+    {
+      if (IsBlockCodecAvailable(codec)) return codec;
+    }
+
+    return BlockCodec::Stored;
+  }
+
+  BlockCompressionSettings BlockCompressionSettings::Parse(const std::string& text)
+  {
+    static regex settingsRegex("(stored|lzms|lz4|zstd)(?::(-?\\d+))?");
+
+    smatch match;
+    if (!regex_match(text, match, settingsRegex)) throw runtime_error("Invalid compression settings " + text + ".");
+
+    BlockCompressionSettings result{};
+    if (match[1] == "stored") result.Codec = BlockCodec::Stored;
+    else if (match[1] == "lzms") result.Codec = BlockCodec::Lzms;
+    else if (match[1] == "lz4") result.Codec = BlockCodec::Lz4;
+    else if (match[1] == "zstd") result.Codec = BlockCodec::Zstd;
+
+    if (match[2].matched) result.Level = stoi(match[2]);
+
+    if (!IsBlockCodecAvailable(result.Codec)) throw runtime_error("Compression codec " + match[1].str() + " is not available in this build.");
+    return result;
+  }
+
+  BlockCodec BlockCompressionSettings::ContainerCodec() const
+  {
+    if (!DictionarySize) return Codec;
+
+    switch (Codec)
+    {
+    case BlockCodec::Lz4:
+      return BlockCodec::Lz4Frames;
+    case BlockCodec::Zstd:
+      return BlockCodec::ZstdFrames;
+    default:
+      throw runtime_error(string("Compression codec ") + GetBlockCodecName(Codec) + " does not support dictionaries, use lz4 or zstd.");
+    }
+  }
+
+  void CompressBlock(const BlockCompressionSettings& settings, std::span<const uint8_t> input, std::vector<uint8_t>& output)
+  {
+    switch (settings.Codec)
+    {
+    case BlockCodec::Stored:
+      output.assign(input.begin(), input.end());
+      break;
+#ifdef _WIN32
+    case BlockCodec::Lzms:
+      CompressLzms(input, output);
+      break;
+#endif
+#ifdef SHADERGENERATOR_HAS_LZ4
+    case BlockCodec::Lz4:
+      CompressLz4(input, settings.Level, output);
+      break;
+#endif
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    case BlockCodec::Zstd:
+      CompressZstd(input, settings.Level, output);
+      break;
+#endif
+    default:
+      throw runtime_error("Block codec " + to_string(uint32_t(settings.Codec)) + " is not supported on this platform.");
+    }
+  }
+
+#ifdef SHADERGENERATOR_HAS_LZ4
+  //Concatenates evenly spaced samples, LZ4 uses the dictionary as raw content preceding each frame
+  static vector<uint8_t> SampleDictionary(const vector<span<const uint8_t>>& samples, size_t capacity)
+  {
+    size_t totalSize = 0;
+    for (auto& sample : samples)
+    {
+      totalSize += sample.size();
+    }
+
+    vector<uint8_t> dictionary;
+    dictionary.reserve(min(capacity, totalSize));
+
+    auto stride = max<double>(double(totalSize) / capacity, 1.0);
+    auto next = 0.0;
+    size_t position = 0;
+    for (auto& sample : samples)
+    {
+      if (dictionary.size() >= capacity) break;
+
+      if (position >= next)
+      {
+        auto length = min(sample.size(), capacity - dictionary.size());
+        dictionary.insert(dictionary.end(), sample.begin(), sample.begin() + length);
+        next += sample.size() * stride;
+      }
+
+      position += sample.size();
+    }
+
+    return dictionary;
+  }
+#endif
+
+#ifdef SHADERGENERATOR_HAS_ZSTD
+  static vector<uint8_t> TrainDictionary(const vector<span<const uint8_t>>& samples, size_t capacity)
+  {
+    vector<uint8_t> samplesBuffer;
+    vector<size_t> sampleSizes;
+    sampleSizes.reserve(samples.size());
+    for (auto& sample : samples)
+    {
+      samplesBuffer.insert(samplesBuffer.end(), sample.begin(), sample.end());
+      sampleSizes.push_back(sample.size());
+    }
+
+    //Small groups cannot fill a large dictionary
+    vector<uint8_t> dictionary(min(capacity, samplesBuffer.size() / 4));
+    auto dictionaryLength = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), samplesBuffer.data(), sampleSizes.data(), unsigned(sampleSizes.size()));
+    if (ZDICT_isError(dictionaryLength))
+    {
+      printf("Dictionary training failed: %s, compressing without a dictionary.\n", ZDICT_getErrorName(dictionaryLength));
+      return {};
+    }
+
+    dictionary.resize(dictionaryLength);
+    return dictionary;
+  }
+#endif
+
+#ifdef SHADERGENERATOR_HAS_LZ4
+  struct lz4_stream_deleter
+  {
+    void operator()(LZ4_stream_t* stream) const noexcept
+    {
+      LZ4_freeStream(stream);
+    }
+
+    void operator()(LZ4_streamHC_t* stream) const noexcept
+    {
+      LZ4_freeStreamHC(stream);
+    }
+  };
+#endif
+
+  FrameCompressor::FrameCompressor(const BlockCompressionSettings& settings, [[maybe_unused]] const std::vector<std::span<const uint8_t>>& samples) :
+    _settings(settings)
+  {
+    switch (_settings.ContainerCodec())
+    {
+#ifdef SHADERGENERATOR_HAS_LZ4
+    case BlockCodec::Lz4Frames:
+      _dictionary = SampleDictionary(samples, _settings.DictionarySize);
+      break;
+#endif
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    case BlockCodec::ZstdFrames:
+      _dictionary = TrainDictionary(samples, _settings.DictionarySize);
+      _zstdDictionary = ZSTD_createCDict(_dictionary.data(), _dictionary.size(), _settings.Level ? _settings.Level : ZSTD_CLEVEL_DEFAULT);
+      if (!_zstdDictionary) throw runtime_error("Failed to create Zstandard dictionary.");
+      break;
+#endif
+    default:
+      throw runtime_error(string("Frame codec ") + GetBlockCodecName(_settings.ContainerCodec()) + " is not supported on this platform.");
+    }
+  }
+
+  FrameCompressor::~FrameCompressor()
+  {
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    if (_zstdDictionary) ZSTD_freeCDict(_zstdDictionary);
+#endif
+  }
+
+  const std::vector<uint8_t>& FrameCompressor::Dictionary() const
+  {
+    return _dictionary;
+  }
+
+  void FrameCompressor::Compress([[maybe_unused]] std::span<const uint8_t> input, [[maybe_unused]] std::vector<uint8_t>& output) const
+  {
+    switch (_settings.ContainerCodec())
+    {
+#ifdef SHADERGENERATOR_HAS_LZ4
+    case BlockCodec::Lz4Frames:
+    {
+      if (input.size() > LZ4_MAX_INPUT_SIZE) throw runtime_error("Shader is too large for LZ4 compression.");
+
+      auto offset = output.size();
+      output.resize(offset + LZ4_compressBound(int(input.size())));
+
+      //Streams are reset before every frame, so frames only reference the dictionary
+      auto source = reinterpret_cast<const char*>(input.data());
+      auto target = reinterpret_cast<char*>(output.data() + offset);
+      auto dictionary = reinterpret_cast<const char*>(_dictionary.data());
+      int compressedLength;
+      if (_settings.Level > 0)
+      {
+        thread_local unique_ptr<LZ4_streamHC_t, lz4_stream_deleter> stream{ LZ4_createStreamHC() };
+        LZ4_resetStreamHC_fast(stream.get(), _settings.Level);
+        LZ4_loadDictHC(stream.get(), dictionary, int(_dictionary.size()));
+        compressedLength = LZ4_compress_HC_continue(stream.get(), source, target, int(input.size()), int(output.size() - offset));
+      }
+      else
+      {
+        thread_local unique_ptr<LZ4_stream_t, lz4_stream_deleter> stream{ LZ4_createStream() };
+        LZ4_resetStream_fast(stream.get());
+        LZ4_loadDict(stream.get(), dictionary, int(_dictionary.size()));
+        compressedLength = LZ4_compress_fast_continue(stream.get(), source, target, int(input.size()), int(output.size() - offset), 1);
+      }
+      if (compressedLength <= 0) throw runtime_error("LZ4 compression failed.");
+
+      output.resize(offset + compressedLength);
+      break;
+    }
+#endif
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    case BlockCodec::ZstdFrames:
+    {
+      thread_local unique_ptr<ZSTD_CCtx, zstd_context_deleter> context{ ZSTD_createCCtx() };
+
+      auto offset = output.size();
+      output.resize(offset + ZSTD_compressBound(input.size()));
+      auto compressedLength = ZSTD_compress_usingCDict(context.get(), output.data() + offset, output.size() - offset, input.data(), input.size(), _zstdDictionary);
+      if (ZSTD_isError(compressedLength)) throw runtime_error(string("Zstandard compression failed: ") + ZSTD_getErrorName(compressedLength));
+
+      output.resize(offset + compressedLength);
+      break;
+    }
+#endif
+    default:
+      throw runtime_error("Frame codec is not supported on this platform.");
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "pch.h"
+
+namespace ShaderGenerator
+{
+  //Compression method of a shader block, stored in the container index
+  enum class BlockCodec : uint32_t
+  {
+    Stored = 0,
+    Lzms = 1,
+    Lz4 = 2,
+    Zstd = 3,
+
+    //Each variant is compressed as its own frame against the dictionary of the container
+    Lz4Frames = 4,
+    ZstdFrames = 5
+  };
+
+  //Whether the codec was available when building the generator
+  bool IsBlockCodecAvailable(BlockCodec codec);
+
+  const char* GetBlockCodecName(BlockCodec codec);
+
+  //The best codec available on the platform
+  BlockCodec DefaultBlockCodec();
+
+  struct BlockCompressionSettings
+  {
+    BlockCodec Codec = DefaultBlockCodec();
+
+    //Zero selects the default level of the codec, for LZ4 a positive level selects the high compression mode
+    int Level = 0;
+
+    //Nonzero compresses each variant as its own frame against a dictionary of up to this many bytes trained per group
+    size_t DictionarySize = 0;
+
+    //The codec written into the container index
+    BlockCodec ContainerCodec() const;
+
+    //Parses <codec>[:<level>], where codec is one of stored, lzms, lz4 or zstd
+    static BlockCompressionSettings Parse(const std::string& text);
+  };
+
+  //Compresses the input into the output buffer, replacing its contents
+  void CompressBlock(const BlockCompressionSettings& settings, std::span<const uint8_t> input, std::vector<uint8_t>& output);
+
+  //Compresses variants one by one against a shared dictionary, so the loader can decode any of them on its own
+  class FrameCompressor
+  {
+  public:
+    //Builds the dictionary from the sample variants
+    FrameCompressor(const BlockCompressionSettings& settings, const std::vector<std::span<const uint8_t>>& samples);
+    ~FrameCompressor();
+
+    FrameCompressor(const FrameCompressor&) = delete;
+    FrameCompressor& operator=(const FrameCompressor&) = delete;
+
+    const std::vector<uint8_t>& Dictionary() const;
+
+    //Appends the compressed frame to the output, can be called from multiple threads
+    void Compress(std::span<const uint8_t> input, std::vector<uint8_t>& output) const;
+
+  private:
+    BlockCompressionSettings _settings;
+    std::vector<uint8_t> _dictionary;
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    ZSTD_CDict* _zstdDictionary = nullptr;
+#endif
+  };
+}
@@ -0,0 +1,189 @@
+#include "pch.h"
+#include "D3DCompilerBackend.h"
+#include "SourceFileCache.h"
+
+#ifdef _WIN32
+using namespace std;
+using namespace winrt;
+
+namespace ShaderGenerator
+{
+  //Serves included files from the source file cache
+  class SourceFileInclude : public ID3DInclude
+  {
+  public:
+    SourceFileInclude(const filesystem::path& sourcePath) :
+      _sourceDirectory(sourcePath.parent_path())
+    { }
+
+    HRESULT __stdcall Open(D3D_INCLUDE_TYPE /*includeType*/, LPCSTR fileName, LPCVOID parentData, LPCVOID* data, UINT* size) override
+    {
+      //Try relative to the including file first, then relative to the source file
+      auto parentDirectory = _sourceDirectory;
+      auto parent = _openedFiles.find(parentData);
+      if (parent != _openedFiles.end()) parentDirectory = parent->second;
+
+      for (auto& directory : { parentDirectory, _sourceDirectory })
+      {
+        auto path = (directory / fileName).lexically_normal();
+        auto content = SourceFileCache::Shared().Read(path);
+        if (!content) continue;
+
+        _openedFiles[content->data()] = path.parent_path();
+        _contents.push_back(content);
+
+        *data = content->data();
+        *size = UINT(content->size());
+        return S_OK;
+      }
+
+      return E_FAIL;
+    }
+
+    HRESULT __stdcall Close(LPCVOID /*data*/) override
+    {
+      return S_OK;
+    }
+
+  private:
+    filesystem::path _sourceDirectory;
+    vector<shared_ptr<const string>> _contents;
+    unordered_map<const void*, filesystem::path> _openedFiles;
+  };
+
+  uint32_t GetCompilationFlags(const ShaderCompilationArguments& options)
+  {
+    auto flags = 0u;
+    if (options.IsDebug)
+    {
+      flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_DEBUG_NAME_FOR_BINARY;
+    }
+
+    switch (options.OptimizationLevel)
+    {
+    case -1:
+      flags |= D3DCOMPILE_SKIP_OPTIMIZATION;
+      break;
+    case 0:
+      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL0;
+      break;
+    case 1:
+      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL1;
+      break;
+    case 2:
+      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL2;
+      break;
+    case 3:
+      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
+      break;
+    }
+
+    return flags;
+  }
+
+  vector<D3D_SHADER_MACRO> GetMacros(const OptionPermutation& permutation)
+  {
+    vector<D3D_SHADER_MACRO> macros;
+    for (auto& define : permutation.Defines)
+    {
+      macros.push_back({ define.first.c_str(), define.second.c_str() });
+    }
+    macros.push_back({ nullptr, nullptr });
+    return macros;
+  }
+
+  std::string D3DCompilerBackend::Identity() const
+  {
+    return "d3d/" + to_string(D3D_COMPILER_VERSION);
+  }
+
+  bool D3DCompilerBackend::Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash)
+  {
+    //Preprocess source, the result covers the contents of every included file
+    auto macros = GetMacros(permutation);
+    SourceFileInclude include{ shader.Path };
+    com_ptr<ID3DBlob> preprocessed, errors;
+    auto sourceName = shader.Path.string();
+    if (FAILED(D3DPreprocess(
+      source.data(),
+      source.size(),
+      sourceName.c_str(),
+      macros.data(),
+      &include,
+      preprocessed.put(),
+      errors.put())))
+    {
+      //Compilation will report the errors
+      return false;
+    }
+
+    sourceHash = content_hasher::hash(preprocessed->GetBufferPointer(), preprocessed->GetBufferSize());
+    return true;
+  }
+
+  bool D3DCompilerBackend::Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages)
+  {
+    //Run compilation
+    auto macros = GetMacros(permutation);
+    SourceFileInclude include{ shader.Path };
+    com_ptr<ID3DBlob> binary, errors;
+    auto sourceName = shader.Path.string();
+    auto success = SUCCEEDED(D3DCompile(
+      source.data(),
+      source.size(),
+      sourceName.c_str(),
+      macros.data(),
+      &include,
+      shader.EntryPoint.c_str(),
+      shader.Target.c_str(),
+      GetCompilationFlags(options),
+      0u,
+      binary.put(),
+      errors.put()));
+
+    //Store binary
+    if (success)
+    {
+      result.Data.resize(binary->GetBufferSize());
+      memcpy(result.Data.data(), binary->GetBufferPointer(), binary->GetBufferSize());
+    }
+
+    if (errors) messages = string((char*)errors->GetBufferPointer(), size_t(errors->GetBufferSize()));
+    return success;
+  }
+
+  void D3DCompilerBackend::ExtractDebugSymbols(CompiledShader& shader)
+  {
+    com_ptr<ID3DBlob> pdb;
+    D3DGetBlobPart(shader.Data.data(), shader.Data.size(), D3D_BLOB_PDB, 0, pdb.put());
+
+    com_ptr<ID3DBlob> pdbName;
+    D3DGetBlobPart(shader.Data.data(), shader.Data.size(), D3D_BLOB_DEBUG_NAME, 0, pdbName.put());
+
+    if (pdb && pdbName)
+    {
+      struct ShaderDebugName
+      {
+        uint16_t Flags;
+        uint16_t NameLength;
+      };
+
+      auto pDebugNameData = reinterpret_cast<const ShaderDebugName*>(pdbName->GetBufferPointer());
+      auto fileName = reinterpret_cast<const char*>(pDebugNameData + 1);
+
+      shader.PdbName = fileName;
+      shader.PdbData.resize(pdb->GetBufferSize());
+      memcpy(shader.PdbData.data(), pdb->GetBufferPointer(), pdb->GetBufferSize());
+    }
+  }
+
+  void D3DCompilerBackend::StripDebugSymbols(CompiledShader& shader)
+  {
+    com_ptr<ID3DBlob> stripped;
+    if (FAILED(D3DStripShader(shader.Data.data(), shader.Data.size(), D3DCOMPILER_STRIP_DEBUG_INFO, stripped.put()))) return;
+
+    shader.Data.resize(stripped->GetBufferSize());
+    memcpy(shader.Data.data(), stripped->GetBufferPointer(), stripped->GetBufferSize());
+  }
+}
+#endif
@@ -0,0 +1,22 @@
+#pragma once
+#include "ShaderCompilerBackend.h"
+
+#ifdef _WIN32
+namespace ShaderGenerator
+{
+  //Compiles shaders in-process using the D3DCompiler library
+  class D3DCompilerBackend : public ShaderCompilerBackend
+  {
+  public:
+    virtual std::string Identity() const override;
+
+    virtual bool Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash) override;
+
+    virtual bool Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages) override;
+
+    virtual void ExtractDebugSymbols(CompiledShader& shader) override;
+
+    virtual void StripDebugSymbols(CompiledShader& shader) override;
+  };
+}
+#endif
@@ -0,0 +1,137 @@
+#include "pch.h"
+#include "ExternalCompilerBackend.h"
+#include "FileAttributes.h"
+#include "IO.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  static string QuoteArgument(const string& argument)
+  {
+    return "\"" + argument + "\"";
+  }
+
+  ExternalCompilerBackend::ExternalCompilerBackend(const std::filesystem::path& compilerPath) :
+    _compilerPath(compilerPath)
+  {
+    if (!exists(_compilerPath)) throw runtime_error("Failed to find shader compiler " + _compilerPath.string() + ".");
+
+    //Updating the compiler invalidates its cached results
+    auto compilerTime = get_file_time(_compilerPath, file_time_kind::modification).time_since_epoch().count();
+    _identity = "external/" + absolute(_compilerPath).generic_string() + "/" + to_string(file_size(_compilerPath)) + "/" + to_string(compilerTime);
+
+    //Concurrent groups and processes use separate directories
+    random_device random;
+    stringstream directoryName;
+    directoryName << "ShaderGenerator-" << hex << random() << random();
+    _temporaryDirectory = temp_directory_path() / directoryName.str();
+  }
+
+  ExternalCompilerBackend::~ExternalCompilerBackend()
+  {
+    error_code ec;
+    remove_all(_temporaryDirectory, ec);
+  }
+
+  std::string ExternalCompilerBackend::Identity() const
+  {
+    return _identity;
+  }
+
+  bool ExternalCompilerBackend::Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash)
+  {
+    //Running the compiler once more per variant would cost as much as compiling, so the raw inputs are hashed instead
+    sourceHash = HashSources(shader, source, permutation);
+    return true;
+  }
+
+  bool ExternalCompilerBackend::Compile(const ShaderInfo& shader, const std::string& /*source*/, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages)
+  {
+    //Each invocation works in its own directory
+    auto workingDirectory = _temporaryDirectory / to_string(_invocationCount++);
+    auto pdbDirectory = workingDirectory / "pdb";
+    auto outputPath = workingDirectory / "output.bin";
+    auto messagesPath = workingDirectory / "messages.txt";
+
+    error_code ec;
+    create_directories(pdbDirectory, ec);
+    if (ec)
+    {
+      messages = "Failed to create temporary directory " + workingDirectory.string() + ".";
+      return false;
+    }
+
+    //Build command line
+    stringstream command;
+    command << QuoteArgument(_compilerPath.string()) << " -nologo";
+    command << " -T " << shader.Target << " -E " << shader.EntryPoint;
+    for (auto& [name, value] : permutation.Defines)
+    {
+      command << " -D " << QuoteArgument(name + "=" + value);
+    }
+
+    if (options.OptimizationLevel < 0)
+    {
+      command << " -Od";
+    }
+    else
+    {
+      command << " -O" << min(options.OptimizationLevel, 3);
+    }
+
+    auto hasExternalDebugSymbols = options.IsDebug && options.UseExternalDebugSymbols;
+    if (options.IsDebug)
+    {
+      command << " -Zi";
+      if (hasExternalDebugSymbols)
+      {
+        //A trailing separator makes the compiler name the PDB after its hash
+        command << " -Qstrip_debug -Fd " << QuoteArgument((pdbDirectory / "").string());
+      }
+      else
+      {
+        command << " -Qembed_debug";
+      }
+    }
+
+    command << " -Fo " << QuoteArgument(outputPath.string());
+    command << " " << QuoteArgument(absolute(shader.Path).string());
+    command << " 2> " << QuoteArgument(messagesPath.string());
+
+#ifdef _WIN32
+    //The command processor strips the outermost quotes
+    auto exitCode = system(QuoteArgument(command.str()).c_str());
+#else
+    auto exitCode = system(command.str().c_str());
+#endif
+
+    //Collect results
+    messages = ReadAllText(messagesPath);
+
+    auto success = exitCode == 0 && exists(outputPath);
+    if (success)
+    {
+      auto output = ReadAllText(outputPath);
+      result.Data.assign(output.begin(), output.end());
+
+      for (auto& item : directory_iterator(pdbDirectory, ec))
+      {
+        auto pdb = ReadAllText(item.path());
+        result.PdbName = item.path().filename().string();
+        result.PdbData.assign(pdb.begin(), pdb.end());
+        break;
+      }
+    }
+
+    remove_all(workingDirectory, ec);
+    return success;
+  }
+
+  void ExternalCompilerBackend::ExtractDebugSymbols(CompiledShader& /*shader*/)
+  { }
+
+  void ExternalCompilerBackend::StripDebugSymbols(CompiledShader& /*shader*/)
+  { }
+}
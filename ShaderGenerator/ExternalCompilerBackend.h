@@ -0,0 +1,30 @@
+#pragma once
+#include "ShaderCompilerBackend.h"
+
+namespace ShaderGenerator
+{
+  //Runs a compiler executable accepting dxc style arguments for each variant
+  class ExternalCompilerBackend : public ShaderCompilerBackend
+  {
+  public:
+    ExternalCompilerBackend(const std::filesystem::path& compilerPath);
+    ~ExternalCompilerBackend();
+
+    virtual std::string Identity() const override;
+
+    virtual bool Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash) override;
+
+    //Debug symbols are separated by the compiler itself, when external debug symbols are requested
+    virtual bool Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages) override;
+
+    virtual void ExtractDebugSymbols(CompiledShader& shader) override;
+
+    virtual void StripDebugSymbols(CompiledShader& shader) override;
+
+  private:
+    std::filesystem::path _compilerPath;
+    std::string _identity;
+    std::filesystem::path _temporaryDirectory;
+    std::atomic<size_t> _invocationCount = 0;
+  };
+}
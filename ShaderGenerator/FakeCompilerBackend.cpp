@@ -0,0 +1,232 @@
+#include "pch.h"
+#include "FakeCompilerBackend.h"
+#include "SourceFileCache.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  const char FakeBytecodeMagic[4] = { 'F', 'A', 'K', 'E' };
+  const char FakeDebugMagic[4] = { 'F', 'D', 'B', 'G' };
+
+  //Spread of the log-normal sizes, about one in thirty variants is over three times the average
+  const double FakeSizeSigma = 0.75;
+
+  //Deterministic pseudo random stream seeded from a hash
+  class FakeByteGenerator
+  {
+  public:
+    FakeByteGenerator(const content_hash& seed)
+    {
+      memcpy(&_state, seed.bytes.data(), sizeof(_state));
+    }
+
+    uint64_t Next()
+    {
+      //SplitMix64
+      auto value = (_state += 0x9e3779b97f4a7c15ull);
+      value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+      value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+      return value ^ (value >> 31);
+    }
+
+    //Uniform in (0, 1]
+    double NextDouble()
+    {
+      return double((Next() >> 11) + 1) / double(1ull << 53);
+    }
+
+    //Appends bytes with a limited alphabet, so they compress about as well as real bytecode
+    void Append(vector<uint8_t>& data, size_t length)
+    {
+      while (length > 0)
+      {
+        auto value = Next();
+        for (size_t i = 0; i < sizeof(value) && length > 0; i++, length--)
+        {
+          data.push_back(uint8_t((value >> (i * 8)) & 0x3f));
+        }
+      }
+    }
+
+  private:
+    uint64_t _state = 0;
+  };
+
+  template<typename T>
+  static void AppendValue(vector<uint8_t>& data, const T& value)
+  {
+    auto bytes = reinterpret_cast<const uint8_t*>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  template<typename T>
+  static bool ReadValue(const vector<uint8_t>& data, size_t offset, T& value)
+  {
+    if (offset + sizeof(T) > data.size()) return false;
+    memcpy(&value, data.data() + offset, sizeof(T));
+    return true;
+  }
+
+  static bool IsIdentifierCharacter(char character)
+  {
+    return isalnum(uint8_t(character)) || character == '_';
+  }
+
+  //Checks if the name appears as a whole identifier outside the pragma lines, which mention every option of the group
+  static bool IsDefineReferenced(const string& source, const string& name)
+  {
+    for (auto position = source.find(name); position != string::npos; position = source.find(name, position + 1))
+    {
+      auto isWordStart = position == 0 || !IsIdentifierCharacter(source[position - 1]);
+      auto isWordEnd = position + name.size() == source.size() || !IsIdentifierCharacter(source[position + name.size()]);
+      if (!isWordStart || !isWordEnd) continue;
+
+      auto lineStart = source.rfind('\n', position);
+      auto textStart = source.find_first_not_of(" \t", lineStart == string::npos ? 0 : lineStart + 1);
+      if (source[textStart] != '#') return true;
+
+      auto directiveStart = source.find_first_not_of(" \t", textStart + 1);
+      if (source.compare(directiveStart, 6, "pragma") != 0) return true;
+    }
+
+    return false;
+  }
+
+  FakeCompilerBackend::FakeCompilerBackend(const Settings& settings) :
+    _settings(settings)
+  { }
+
+  std::string FakeCompilerBackend::Identity() const
+  {
+    auto result = "fake/" + to_string(_settings.Size);
+    if (_settings.Distribution == SizeDistribution::LogNormal) result += "/lognormal";
+    return result;
+  }
+
+  bool FakeCompilerBackend::Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash)
+  {
+    //Gather sources in a stable order
+    auto dependencies = shader.Dependencies;
+    sort(dependencies.begin(), dependencies.end());
+
+    vector<shared_ptr<const string>> contents;
+    for (auto& dependency : dependencies)
+    {
+      auto content = SourceFileCache::Shared().Read(dependency);
+      if (content) contents.push_back(content);
+    }
+
+    content_hasher hasher;
+    hasher.add(source);
+    for (auto& content : contents)
+    {
+      hasher.add(*content);
+    }
+
+    for (auto& [name, value] : permutation.Defines)
+    {
+      auto isUsed = IsDefineReferenced(source, name);
+      for (size_t i = 0; i < contents.size() && !isUsed; i++)
+      {
+        isUsed = IsDefineReferenced(*contents[i], name);
+      }
+
+      if (!isUsed) continue;
+      hasher.add(name);
+      hasher.add(value);
+    }
+
+    sourceHash = hasher.finish();
+    return true;
+  }
+
+  bool FakeCompilerBackend::Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& /*messages*/)
+  {
+    if (_settings.Latency.count() > 0) this_thread::sleep_for(_settings.Latency);
+
+    //Variants of a group share the first half of their code, like real variants share most of their instructions
+    content_hash sourceHash;
+    Preprocess(shader, source, permutation, sourceHash);
+
+    content_hasher groupHasher;
+    groupHasher.add(source);
+    groupHasher.add(shader.Target);
+    groupHasher.add(shader.EntryPoint);
+    groupHasher.add_value(options.OptimizationLevel);
+    auto groupHash = groupHasher.finish();
+
+    content_hasher variantHasher;
+    variantHasher.add_value(groupHash);
+    variantHasher.add_value(sourceHash);
+    auto variantHash = variantHasher.finish();
+
+    FakeByteGenerator groupBytes{ groupHash }, variantBytes{ variantHash };
+    uint32_t codeSize;
+    if (_settings.Distribution == SizeDistribution::LogNormal)
+    {
+      //Box-Muller transform, the mean of the sizes stays at the average
+      auto normal = sqrt(-2.0 * log(variantBytes.NextDouble())) * cos(2.0 * 3.14159265358979323846 * variantBytes.NextDouble());
+      auto size = double(_settings.Size) * exp(FakeSizeSigma * normal - FakeSizeSigma * FakeSizeSigma / 2.0);
+      codeSize = uint32_t(clamp(size, 16.0, 64.0 * double(_settings.Size))) & ~3u;
+    }
+    else
+    {
+      codeSize = uint32_t((_settings.Size / 2 + variantBytes.Next() % (_settings.Size + 1)) & ~3ull);
+    }
+
+    result.Data.clear();
+    result.Data.reserve(sizeof(FakeBytecodeMagic) + sizeof(uint32_t) + codeSize);
+    result.Data.insert(result.Data.end(), FakeBytecodeMagic, FakeBytecodeMagic + sizeof(FakeBytecodeMagic));
+    AppendValue(result.Data, codeSize);
+    groupBytes.Append(result.Data, codeSize / 2);
+    variantBytes.Append(result.Data, codeSize - codeSize / 2);
+
+    //Debug builds embed a name and a symbol blob after the code
+    if (options.IsDebug)
+    {
+      auto pdbName = variantHash.to_string().substr(0, 16) + ".pdb";
+      auto pdbSize = uint32_t(codeSize / 2);
+
+      result.Data.insert(result.Data.end(), FakeDebugMagic, FakeDebugMagic + sizeof(FakeDebugMagic));
+      AppendValue(result.Data, uint32_t(pdbName.size()));
+      result.Data.insert(result.Data.end(), pdbName.begin(), pdbName.end());
+      AppendValue(result.Data, pdbSize);
+      variantBytes.Append(result.Data, pdbSize);
+    }
+
+    return true;
+  }
+
+  void FakeCompilerBackend::ExtractDebugSymbols(CompiledShader& shader)
+  {
+    uint32_t codeSize, nameLength, pdbSize;
+    auto offset = sizeof(FakeBytecodeMagic);
+    if (!ReadValue(shader.Data, offset, codeSize)) return;
+
+    offset += sizeof(uint32_t) + codeSize;
+    if (offset + sizeof(FakeDebugMagic) > shader.Data.size() || memcmp(shader.Data.data() + offset, FakeDebugMagic, sizeof(FakeDebugMagic)) != 0) return;
+
+    offset += sizeof(FakeDebugMagic);
+    if (!ReadValue(shader.Data, offset, nameLength) || offset + sizeof(uint32_t) + nameLength > shader.Data.size()) return;
+
+    offset += sizeof(uint32_t);
+    auto name = reinterpret_cast<const char*>(shader.Data.data() + offset);
+
+    offset += nameLength;
+    if (!ReadValue(shader.Data, offset, pdbSize) || offset + sizeof(uint32_t) + pdbSize > shader.Data.size()) return;
+
+    offset += sizeof(uint32_t);
+    shader.PdbName.assign(name, nameLength);
+    shader.PdbData.assign(shader.Data.begin() + offset, shader.Data.begin() + offset + pdbSize);
+  }
+
+  void FakeCompilerBackend::StripDebugSymbols(CompiledShader& shader)
+  {
+    uint32_t codeSize;
+    if (!ReadValue(shader.Data, sizeof(FakeBytecodeMagic), codeSize)) return;
+
+    shader.Data.resize(min(shader.Data.size(), sizeof(FakeBytecodeMagic) + sizeof(uint32_t) + codeSize));
+  }
+}
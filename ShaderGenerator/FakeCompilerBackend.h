@@ -0,0 +1,46 @@
+#pragma once
+#include "ShaderCompilerBackend.h"
+
+namespace ShaderGenerator
+{
+  //Generates deterministic synthetic bytecode, allows running and measuring the pipeline without a shader compiler
+  class FakeCompilerBackend : public ShaderCompilerBackend
+  {
+  public:
+    enum class SizeDistribution
+    {
+      //Sizes vary evenly between half and one and a half times the average
+      Uniform,
+
+      //Most sizes are below the average with a long tail of large variants, like the variants of real shaders
+      LogNormal
+    };
+
+    struct Settings
+    {
+      //Time spent compiling each variant
+      std::chrono::milliseconds Latency{ 0 };
+
+      //Average bytecode size
+      size_t Size = 4096;
+
+      SizeDistribution Distribution = SizeDistribution::Uniform;
+    };
+
+    FakeCompilerBackend(const Settings& settings);
+
+    virtual std::string Identity() const override;
+
+    //Defines which do not appear in the sources are ignored, like an unused macro would be
+    virtual bool Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash) override;
+
+    virtual bool Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages) override;
+
+    virtual void ExtractDebugSymbols(CompiledShader& shader) override;
+
+    virtual void StripDebugSymbols(CompiledShader& shader) override;
+
+  private:
+    Settings _settings;
+  };
+}
@@ -5,10 +5,13 @@ using namespace std;
 using namespace std::chrono;
 using namespace std::filesystem;
 
+#ifdef _WIN32
 using namespace winrt;
+#endif
 
 namespace ShaderGenerator
 {
+#ifdef _WIN32
   handle open_file(const path& filePath, uint32_t access)
   {
     return handle(CreateFile(
@@ -39,4 +42,17 @@ namespace ShaderGenerator
 
     return system_clock::from_time_t(clock::to_time_t(clock::from_file_time(fileTime)));
   }
-}
\ No newline at end of file
+#else
+  time_point<system_clock> get_file_time(const path& filePath, file_time_kind kind)
+  {
+    //Only the modification time is available portably, missing files report the epoch like on Windows
+    if (kind != file_time_kind::modification) throw runtime_error("Only file modification times are supported on this platform.");
+
+    error_code ec;
+    auto fileTime = last_write_time(filePath, ec);
+    if (ec) return {};
+
+    return system_clock::from_time_t(system_clock::to_time_t(time_point_cast<system_clock::duration>(file_clock::to_sys(fileTime))));
+  }
+#endif
+}
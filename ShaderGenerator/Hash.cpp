@@ -0,0 +1,160 @@
+#include "pch.h"
+#include "Hash.h"
+
+using namespace std;
+
+namespace ShaderGenerator
+{
+  static const uint32_t sha256_round_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+  static inline uint32_t rotate_right(uint32_t value, int count)
+  {
+    return (value >> count) | (value << (32 - count));
+  }
+
+  std::string content_hash::to_string() const
+  {
+    static const char digits[] = "0123456789abcdef";
+
+    string result;
+    result.reserve(bytes.size() * 2);
+    for (auto byte : bytes)
+    {
+      result.push_back(digits[byte >> 4]);
+      result.push_back(digits[byte & 0xf]);
+    }
+    return result;
+  }
+
+  content_hasher::content_hasher() :
+    _state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 },
+    _buffer{}
+  { }
+
+  void content_hasher::add(const void* data, size_t size)
+  {
+    auto bytes = static_cast<const uint8_t*>(data);
+    _totalLength += size;
+
+    //Complete a partially filled chunk first
+    if (_bufferLength > 0)
+    {
+      auto length = min(size, _buffer.size() - _bufferLength);
+      memcpy(_buffer.data() + _bufferLength, bytes, length);
+      _bufferLength += length;
+      bytes += length;
+      size -= length;
+
+      if (_bufferLength < _buffer.size()) return;
+
+      process_chunk(_buffer.data());
+      _bufferLength = 0;
+    }
+
+    //Process whole chunks in place
+    for (; size >= _buffer.size(); bytes += _buffer.size(), size -= _buffer.size())
+    {
+      process_chunk(bytes);
+    }
+
+    //Keep the remainder for later
+    if (size > 0)
+    {
+      memcpy(_buffer.data(), bytes, size);
+      _bufferLength = size;
+    }
+  }
+
+  void content_hasher::add(const std::string& text)
+  {
+    add_value(uint64_t(text.size()));
+    add(text.data(), text.size());
+  }
+
+  content_hash content_hasher::finish()
+  {
+    auto bitLength = _totalLength * 8;
+
+    //Pad message to 56 bytes modulo 64, then append the big endian bit length
+    uint8_t padding[72] = { 0x80 };
+    auto paddingLength = (_bufferLength < 56 ? 56 : 120) - _bufferLength;
+    for (auto i = 0; i < 8; i++)
+    {
+      padding[paddingLength + i] = uint8_t(bitLength >> (56 - i * 8));
+    }
+    add(padding, paddingLength + 8);
+
+    content_hash result;
+    for (size_t i = 0; i < _state.size(); i++)
+    {
+      result.bytes[i * 4 + 0] = uint8_t(_state[i] >> 24);
+      result.bytes[i * 4 + 1] = uint8_t(_state[i] >> 16);
+      result.bytes[i * 4 + 2] = uint8_t(_state[i] >> 8);
+      result.bytes[i * 4 + 3] = uint8_t(_state[i]);
+    }
+    return result;
+  }
+
+  content_hash content_hasher::hash(const void* data, size_t size)
+  {
+    content_hasher hasher;
+    hasher.add(data, size);
+    return hasher.finish();
+  }
+
+  void content_hasher::process_chunk(const uint8_t* chunk)
+  {
+    uint32_t words[64];
+    for (auto i = 0; i < 16; i++)
+    {
+      words[i] = uint32_t(chunk[i * 4]) << 24 | uint32_t(chunk[i * 4 + 1]) << 16 | uint32_t(chunk[i * 4 + 2]) << 8 | uint32_t(chunk[i * 4 + 3]);
+    }
+
+    for (auto i = 16; i < 64; i++)
+    {
+      auto s0 = rotate_right(words[i - 15], 7) ^ rotate_right(words[i - 15], 18) ^ (words[i - 15] >> 3);
+      auto s1 = rotate_right(words[i - 2], 17) ^ rotate_right(words[i - 2], 19) ^ (words[i - 2] >> 10);
+      words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+    }
+
+    auto a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    auto e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+
+    for (auto i = 0; i < 64; i++)
+    {
+      auto s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+      auto choice = (e & f) ^ (~e & g);
+      auto temp1 = h + s1 + choice + sha256_round_constants[i] + words[i];
+      auto s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+      auto majority = (a & b) ^ (a & c) ^ (b & c);
+      auto temp2 = s0 + majority;
+
+      h = g;
+      g = f;
+      f = e;
+      e = d + temp1;
+      d = c;
+      c = b;
+      b = a;
+      a = temp1 + temp2;
+    }
+
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+
+namespace ShaderGenerator
+{
+  //A SHA-256 digest used to address content
+  struct content_hash
+  {
+    std::array<uint8_t, 32> bytes{};
+
+    std::string to_string() const;
+
+    bool operator==(const content_hash&) const = default;
+  };
+
+  //Incremental SHA-256 hasher
+  class content_hasher
+  {
+  public:
+    content_hasher();
+
+    void add(const void* data, size_t size);
+
+    //Adds a length prefixed string, so consecutive fields cannot run into each other
+    void add(const std::string& text);
+
+    template<typename T>
+    void add_value(const T& value)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      add(&value, sizeof(T));
+    }
+
+    content_hash finish();
+
+    static content_hash hash(const void* data, size_t size);
+
+  private:
+    std::array<uint32_t, 8> _state;
+    std::array<uint8_t, 64> _buffer;
+    size_t _bufferLength = 0;
+    uint64_t _totalLength = 0;
+
+    void process_chunk(const uint8_t* chunk);
+  };
+}
+
+template<>
+struct std::hash<ShaderGenerator::content_hash>
+{
+  size_t operator()(const ShaderGenerator::content_hash& value) const noexcept
+  {
+    size_t result;
+    memcpy(&result, value.bytes.data(), sizeof(result));
+    return result;
+  }
+};
@@ -8,32 +8,22 @@ namespace ShaderGenerator
 {
   std::string ReadAllText(const std::filesystem::path& path)
   {
-    FILE* file = nullptr;
-    _wfopen_s(&file, path.c_str(), L"rb");
-    if (!file) return "";
+    ifstream stream(path, ios::in | ios::binary);
+    if (!stream.good()) return "";
 
-    fseek(file, 0, SEEK_END);
-    auto length = ftell(file);
-
-    string buffer(length, '\0');
-
-    fseek(file, 0, SEEK_SET);
-    fread_s(buffer.data(), length, length, 1, file);
-    fclose(file);
-
-    return buffer;
+    return string(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
   }
 
   bool WriteAllText(const std::filesystem::path& path, const std::string& text)
   {
-    FILE* file = nullptr;
-    _wfopen_s(&file, path.c_str(), L"wb");
-    if (!file) return false;
+    ofstream stream(path, ios::out | ios::binary);
 
-    fwrite(text.data(), 1, text.size(), file);
-    fclose(file);
+    if (stream.good())
+    {
+      stream.write(text.data(), text.size());
+    }
 
-    return true;
+    return stream.good();
   }
 
   bool WriteAllBytes(const path& path, const vector<uint8_t>& bytes)
@@ -47,4 +37,163 @@ namespace ShaderGenerator
 
     return stream.good();
   }
-}
\ No newline at end of file
+
+  std::string EscapeJson(const std::string& text)
+  {
+    string result;
+    result.reserve(text.size());
+    for (auto character : text)
+    {
+      switch (character)
+      {
+      case '\\':
+      case '"':
+        result += '\\';
+        result += character;
+        break;
+      case '\n':
+        result += "\\n";
+        break;
+      case '\t':
+        result += "\\t";
+        break;
+      default:
+        if (uint8_t(character) < 0x20) result += ' ';
+        else result += character;
+        break;
+      }
+    }
+    return result;
+  }
+
+#ifdef _WIN32
+  OutputFile::OutputFile(const std::filesystem::path& path)
+  {
+    _file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE) throw runtime_error("Failed to create file " + path.string() + ".");
+  }
+
+  void OutputFile::Write(const std::vector<std::span<const uint8_t>>& buffers)
+  {
+    //Gather writes need page aligned buffers, so the buffers are written one by one
+    for (auto& buffer : buffers)
+    {
+      auto data = buffer.data();
+      auto remaining = buffer.size();
+      while (remaining > 0)
+      {
+        DWORD writtenLength;
+        auto length = DWORD(min<size_t>(remaining, 1u << 30));
+        if (!WriteFile(_file, data, length, &writtenLength, nullptr)) throw runtime_error("Failed to write file.");
+
+        data += writtenLength;
+        remaining -= writtenLength;
+        _size += writtenLength;
+      }
+    }
+  }
+
+  void OutputFile::WriteAt(uint64_t offset, std::span<const uint8_t> buffer)
+  {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = uint32_t(offset);
+    overlapped.OffsetHigh = uint32_t(offset >> 32);
+
+    DWORD writtenLength;
+    if (!WriteFile(_file, buffer.data(), DWORD(buffer.size()), &writtenLength, &overlapped) || writtenLength != buffer.size())
+    {
+      throw runtime_error("Failed to write file.");
+    }
+
+    //Writing with an offset moves the file pointer on synchronous handles
+    LARGE_INTEGER position;
+    position.QuadPart = LONGLONG(_size);
+    SetFilePointerEx(_file, position, nullptr, FILE_BEGIN);
+  }
+
+  void OutputFile::Close()
+  {
+    if (_file == INVALID_HANDLE_VALUE) return;
+
+    auto result = CloseHandle(_file);
+    _file = INVALID_HANDLE_VALUE;
+    if (!result) throw runtime_error("Failed to close file.");
+  }
+#else
+  OutputFile::OutputFile(const std::filesystem::path& path)
+  {
+    _file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (_file < 0) throw runtime_error("Failed to create file " + path.string() + ".");
+  }
+
+  void OutputFile::Write(const std::vector<std::span<const uint8_t>>& buffers)
+  {
+    vector<iovec> vectors;
+    vectors.reserve(buffers.size());
+    for (auto& buffer : buffers)
+    {
+      if (buffer.empty()) continue;
+      vectors.push_back({ const_cast<uint8_t*>(buffer.data()), buffer.size() });
+    }
+
+    //Write as many buffers at once as allowed, and continue after partial writes
+    for (size_t index = 0; index < vectors.size();)
+    {
+      auto count = int(min<size_t>(vectors.size() - index, IOV_MAX));
+      auto writtenLength = writev(_file, vectors.data() + index, count);
+      if (writtenLength < 0)
+      {
+        if (errno == EINTR) continue;
+        throw runtime_error("Failed to write file.");
+      }
+
+      _size += writtenLength;
+
+      auto remaining = size_t(writtenLength);
+      while (index < vectors.size() && remaining >= vectors[index].iov_len)
+      {
+        remaining -= vectors[index].iov_len;
+        index++;
+      }
+
+      if (remaining > 0)
+      {
+        vectors[index].iov_base = static_cast<uint8_t*>(vectors[index].iov_base) + remaining;
+        vectors[index].iov_len -= remaining;
+      }
+    }
+  }
+
+  void OutputFile::WriteAt(uint64_t offset, std::span<const uint8_t> buffer)
+  {
+    if (pwrite(_file, buffer.data(), buffer.size(), off_t(offset)) != ssize_t(buffer.size()))
+    {
+      throw runtime_error("Failed to write file.");
+    }
+  }
+
+  void OutputFile::Close()
+  {
+    if (_file < 0) return;
+
+    auto result = close(_file);
+    _file = -1;
+    if (result != 0) throw runtime_error("Failed to close file.");
+  }
+#endif
+
+  OutputFile::~OutputFile()
+  {
+    try
+    {
+      Close();
+    }
+    catch (...)
+    { }
+  }
+
+  uint64_t OutputFile::Size() const
+  {
+    return _size;
+  }
+}
@@ -7,4 +7,37 @@ namespace ShaderGenerator
   bool WriteAllText(const std::filesystem::path& path, const std::string& text);
 
   bool WriteAllBytes(const std::filesystem::path& path, const std::vector<uint8_t>& bytes);
+
+  //Escapes the text for a JSON string literal
+  std::string EscapeJson(const std::string& text);
+
+  //Binary file written front to back, buffers are written with vectored writes where available
+  class OutputFile
+  {
+  public:
+    //Creates or truncates the file, throws on failure
+    OutputFile(const std::filesystem::path& path);
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    //Appends the buffers after each other, without joining them in memory first
+    void Write(const std::vector<std::span<const uint8_t>>& buffers);
+
+    //Overwrites already written data, the write position is left untouched
+    void WriteAt(uint64_t offset, std::span<const uint8_t> buffer);
+
+    uint64_t Size() const;
+
+    void Close();
+
+  private:
+#ifdef _WIN32
+    HANDLE _file;
+#else
+    int _file;
+#endif
+    uint64_t _size = 0ull;
+  };
 }
\ No newline at end of file
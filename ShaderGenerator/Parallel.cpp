@@ -0,0 +1,246 @@
+#include "pch.h"
+#include "Parallel.h"
+
+using namespace std;
+
+namespace ShaderGenerator
+{
+  static thread_local const thread_pool* current_pool = nullptr;
+  static thread_local size_t current_queue = 0;
+
+  atomic<size_t> thread_pool::_sharedThreadCount = 0;
+
+  thread_pool::thread_pool(size_t threadCount)
+  {
+    threadCount = max<size_t>(threadCount, 1);
+
+    _queues.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+    {
+      _queues.push_back(make_unique<worker_queue>());
+    }
+
+    _threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+    {
+      _threads.push_back(thread([this, i] { run_worker(i); }));
+    }
+  }
+
+  thread_pool::~thread_pool()
+  {
+    {
+      lock_guard<mutex> lock(_wakeMutex);
+      _isStopping = true;
+    }
+    _wakeCondition.notify_all();
+
+    for (auto& thread : _threads)
+    {
+      thread.join();
+    }
+  }
+
+  size_t thread_pool::thread_count() const
+  {
+    return _threads.size();
+  }
+
+  void thread_pool::submit(task_t&& task)
+  {
+    auto queueIndex = current_queue_index();
+    if (queueIndex == _queues.size()) queueIndex = _nextQueue++ % _queues.size();
+
+    //Tasks are counted before they are published, so taking them never finds the count at zero
+    add_pending(1);
+    push(queueIndex, move(task));
+    wake(1);
+  }
+
+  void thread_pool::submit_range(size_t count, const std::function<void(size_t)>& func)
+  {
+    if (count == 0) return;
+
+    auto sharedFunc = make_shared<function<void(size_t)>>(func);
+    add_pending(count);
+
+    //Split the range into contiguous slices, one for each worker
+    auto queueCount = _queues.size();
+    for (size_t queueIndex = 0; queueIndex < queueCount; queueIndex++)
+    {
+      auto begin = queueIndex * count / queueCount;
+      auto end = (queueIndex + 1) * count / queueCount;
+      if (begin == end) continue;
+
+      auto& queue = *_queues[queueIndex];
+      lock_guard<mutex> lock(queue.mutex);
+      for (auto index = begin; index < end; index++)
+      {
+        queue.tasks.push_back([sharedFunc, index] { (*sharedFunc)(index); });
+      }
+    }
+
+    wake(count);
+  }
+
+  bool thread_pool::try_run_task()
+  {
+    task_t task;
+    if (!try_take(current_queue_index(), task)) return false;
+
+    task();
+    return true;
+  }
+
+  thread_pool& thread_pool::shared()
+  {
+    static thread_pool pool{ _sharedThreadCount ? _sharedThreadCount.load() : size_t(thread::hardware_concurrency()) };
+    return pool;
+  }
+
+  void thread_pool::set_shared_thread_count(size_t threadCount)
+  {
+    _sharedThreadCount = threadCount;
+  }
+
+  size_t thread_pool::current_queue_index() const
+  {
+    return current_pool == this ? current_queue : _queues.size();
+  }
+
+  void thread_pool::push(size_t queueIndex, task_t&& task)
+  {
+    auto& queue = *_queues[queueIndex];
+    lock_guard<mutex> lock(queue.mutex);
+    queue.tasks.push_back(move(task));
+  }
+
+  void thread_pool::add_pending(size_t count)
+  {
+    //Workers check the count under the lock before sleeping, so the wake up after it cannot be missed
+    lock_guard<mutex> lock(_wakeMutex);
+    _pendingCount += count;
+  }
+
+  void thread_pool::wake(size_t count)
+  {
+    if (count == 1)
+    {
+      _wakeCondition.notify_one();
+    }
+    else
+    {
+      _wakeCondition.notify_all();
+    }
+  }
+
+  bool thread_pool::try_take(size_t queueIndex, task_t& task)
+  {
+    auto queueCount = _queues.size();
+
+    //Take the most recent task of our own queue
+    if (queueIndex < queueCount)
+    {
+      auto& queue = *_queues[queueIndex];
+      lock_guard<mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        task = move(queue.tasks.back());
+        queue.tasks.pop_back();
+        _pendingCount--;
+        return true;
+      }
+    }
+
+    //Steal the oldest task of another queue
+    for (size_t i = 1; i <= queueCount; i++)
+    {
+      auto& queue = *_queues[(queueIndex + i) % queueCount];
+      lock_guard<mutex> lock(queue.mutex);
+      if (!queue.tasks.empty())
+      {
+        task = move(queue.tasks.front());
+        queue.tasks.pop_front();
+        _pendingCount--;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void thread_pool::run_worker(size_t queueIndex)
+  {
+    current_pool = this;
+    current_queue = queueIndex;
+
+    task_t task;
+    while (true)
+    {
+      if (try_take(queueIndex, task))
+      {
+        task();
+        task = nullptr;
+        continue;
+      }
+
+      unique_lock<mutex> lock(_wakeMutex);
+      _wakeCondition.wait(lock, [&] { return _isStopping || _pendingCount > 0; });
+      if (_isStopping && _pendingCount == 0) return;
+    }
+  }
+
+  void parallel_for(size_t count, const std::function<void(size_t)>& func, thread_pool& pool, const cancellation_token* cancellation)
+  {
+    if (count == 0) return;
+
+    //The state is shared with the tasks, as they might finish after we stopped waiting for them
+    struct batch_state
+    {
+      atomic<size_t> remaining;
+      cancellation_token failure;
+      exception_ptr error;
+      mutex completionMutex;
+      condition_variable completed;
+    };
+
+    auto state = make_shared<batch_state>();
+    state->remaining = count;
+
+    pool.submit_range(count, [state, &func, cancellation](size_t index) {
+      if (!state->failure.is_cancelled() && !(cancellation && cancellation->is_cancelled()))
+      {
+        try
+        {
+          func(index);
+        }
+        catch (...)
+        {
+          lock_guard<mutex> lock(state->completionMutex);
+          if (!state->error) state->error = current_exception();
+          state->failure.cancel();
+        }
+      }
+
+      if (--state->remaining == 0)
+      {
+        lock_guard<mutex> lock(state->completionMutex);
+        state->completed.notify_all();
+      }
+    });
+
+    //Help processing items until none are queued, the rest are already running on other threads
+    while (state->remaining > 0)
+    {
+      if (!pool.try_run_task()) break;
+    }
+
+    //The last item signals completion
+    {
+      unique_lock<mutex> lock(state->completionMutex);
+      state->completed.wait(lock, [&] { return state->remaining == 0; });
+    }
+
+    if (state->error) rethrow_exception(state->error);
+  }
+}
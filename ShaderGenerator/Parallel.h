@@ -3,63 +3,93 @@
 
 namespace ShaderGenerator
 {
-  template <class T, class U, class TItems = std::vector<T>>
-  std::vector<U> parallel_map(const TItems& items, const std::function<U(const T&)>& func, uint8_t threadCount = std::thread::hardware_concurrency())
+  //Allows stopping a parallel operation before all of its items are processed
+  class cancellation_token
   {
-    typedef std::pair<const T*, size_t> item_t;
-    typedef std::pair<U, size_t> result_t;
+  public:
+    void cancel() noexcept
+    {
+      _isCancelled = true;
+    }
 
-    std::queue<item_t> workItems;    
-    for (size_t index = 0u; auto& item : items)
+    bool is_cancelled() const noexcept
     {
-      workItems.push(item_t(&item, index++));
+      return _isCancelled;
     }
 
-    std::vector<std::thread> threads;
-    threads.reserve(threadCount);
+  private:
+    std::atomic<bool> _isCancelled = false;
+  };
 
-    std::vector<result_t> results;
-    results.reserve(items.size());
+  //Persistent work-stealing thread pool, each worker owns a task deque and steals from the others when it runs out of work
+  class thread_pool
+  {
+  public:
+    typedef std::function<void()> task_t;
 
-    std::mutex workItemMutex, resultMutex;
-    for (size_t threadIndex = 0u; threadIndex < threadCount; threadIndex++)
-    {
-      auto threadFunc = [&] {
-        const T* input;
-        size_t index;
-
-        while (true)
-        {
-          {
-            std::lock_guard<std::mutex> lock(workItemMutex);
-            if (workItems.size() == 0u) break;
-
-            std::tie(input, index) = workItems.front();
-            workItems.pop();
-          }
-
-          auto output = func(*input);
-
-          {
-            std::lock_guard<std::mutex> lock(resultMutex);
-            results.push_back(result_t(std::move(output), index));
-          }
-        }
-      };
-
-      threads.push_back(std::thread(threadFunc));
-    }
+    explicit thread_pool(size_t threadCount = std::thread::hardware_concurrency());
+    ~thread_pool();
 
-    for (auto& thread : threads)
-    {
-      thread.join();
-    }
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    size_t thread_count() const;
+
+    void submit(task_t&& task);
+
+    //Runs a task for each index, the tasks of adjacent indices are queued on the same worker
+    void submit_range(size_t count, const std::function<void(size_t)>& func);
+
+    //Runs a pending task on the calling thread, used to help out while waiting for results
+    bool try_run_task();
+
+    //Process wide pool shared by the compilation and compression stages
+    static thread_pool& shared();
 
-    std::vector<U> sortedResults(results.size());
-    for (auto& [output, index] : results)
+    //Sets the thread count of the shared pool, only has an effect before its first use
+    static void set_shared_thread_count(size_t threadCount);
+
+  private:
+    struct worker_queue
     {
-      sortedResults[index] = std::move(output);
-    }
-    return sortedResults;
+      std::mutex mutex;
+      std::deque<task_t> tasks;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> _queues;
+    std::vector<std::thread> _threads;
+
+    std::atomic<size_t> _pendingCount = 0;
+    std::atomic<size_t> _nextQueue = 0;
+
+    std::mutex _wakeMutex;
+    std::condition_variable _wakeCondition;
+    bool _isStopping = false;
+
+    static std::atomic<size_t> _sharedThreadCount;
+
+    size_t current_queue_index() const;
+    void push(size_t queueIndex, task_t&& task);
+    void add_pending(size_t count);
+    void wake(size_t count);
+    bool try_take(size_t queueIndex, task_t& task);
+    void run_worker(size_t queueIndex);
+  };
+
+  //Runs func for each index in [0, count) on the pool and waits for completion, the calling thread helps processing the items
+  void parallel_for(size_t count, const std::function<void(size_t)>& func, thread_pool& pool = thread_pool::shared(), const cancellation_token* cancellation = nullptr);
+
+  template <class T, class U, class TItems = std::vector<T>>
+  std::vector<U> parallel_map(const TItems& items, const std::function<U(const T&)>& func, thread_pool& pool = thread_pool::shared(), const cancellation_token* cancellation = nullptr)
+  {
+    //Results are written into their preallocated slots, so they need no synchronization or sorting
+    std::vector<U> results(std::size(items));
+
+    auto first = std::begin(items);
+    parallel_for(results.size(), [&](size_t index) {
+      results[index] = func(first[index]);
+    }, pool, cancellation);
+
+    return results;
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,245 @@
+#include "pch.h"
+#include "Profiler.h"
+#include "IO.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace ShaderGenerator
+{
+  std::atomic<stage_profiler*> stage_profiler::_current = nullptr;
+
+  stage_profiler::stage_profiler(bool isTracing) :
+    _isTracing(isTracing),
+    _origin(clock::now())
+  { }
+
+  stage_profiler* stage_profiler::current() noexcept
+  {
+    return _current.load(memory_order_acquire);
+  }
+
+  void stage_profiler::install(stage_profiler* profiler) noexcept
+  {
+    _current.store(profiler, memory_order_release);
+  }
+
+  uint32_t stage_profiler::thread_index() noexcept
+  {
+    static atomic<uint32_t> nextIndex = 0;
+    thread_local uint32_t index = nextIndex++;
+    return index;
+  }
+
+  void stage_profiler::record(span&& value)
+  {
+    lock_guard<mutex> lock(_mutex);
+
+    //There are only a handful of stages, so they are searched
+    auto stage = find_if(_stages.begin(), _stages.end(), [&](const stage_profiler::stage& item) { return item.name == value.name; });
+    if (stage == _stages.end())
+    {
+      _stages.push_back(stage_profiler::stage{ value.name, {}, 0ull });
+      stage = _stages.end() - 1;
+    }
+
+    stage->durations.push_back(value.duration);
+    stage->bytes += value.bytes;
+
+    if (_isTracing) _spans.push_back(move(value));
+  }
+
+  std::vector<stage_profiler::stage> stage_profiler::stages() const
+  {
+    lock_guard<mutex> lock(_mutex);
+    return _stages;
+  }
+
+  std::vector<stage_profiler::span> stage_profiler::spans() const
+  {
+    lock_guard<mutex> lock(_mutex);
+    return _spans;
+  }
+
+  static string FormatKey(uint64_t key)
+  {
+    char text[24];
+    snprintf(text, sizeof(text), "0x%llx", (unsigned long long)key);
+    return text;
+  }
+
+  void stage_profiler::write_trace(const std::filesystem::path& path) const
+  {
+    auto spans = this->spans();
+
+    //Complete events with microsecond timestamps relative to the creation of the profiler
+    stringstream result;
+    result << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    result << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"ShaderGenerator\"}}";
+    for (auto& span : spans)
+    {
+      result << ",\n{\"name\":\"" << span.name << "\"";
+      result << ",\"cat\":\"" << (span.is_outer ? "group" : span.key ? "variant" : "stage") << "\"";
+      result << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread;
+      result << ",\"ts\":" << duration<double, micro>(span.start - _origin).count();
+      result << ",\"dur\":" << duration<double, micro>(span.duration).count();
+      result << ",\"args\":{";
+
+      auto separator = "";
+      if (!span.group.empty())
+      {
+        result << "\"group\":\"" << EscapeJson(span.group) << "\"";
+        separator = ",";
+      }
+      if (span.key)
+      {
+        result << separator << "\"key\":\"" << FormatKey(*span.key) << "\"";
+        separator = ",";
+      }
+      if (span.bytes) result << separator << "\"bytes\":" << span.bytes;
+      result << "}}";
+    }
+    result << "\n]}\n";
+
+    if (!WriteAllText(path, result.str())) throw runtime_error("Failed to write trace " + path.string() + ".");
+    printf("Trace of %zu spans saved to %s.\n", spans.size(), path.string().c_str());
+  }
+
+  void stage_profiler::print_summary(size_t variantCount) const
+  {
+    auto spans = this->spans();
+    if (spans.empty()) return;
+
+    //Stages
+    auto first = spans.front().start;
+    auto last = first;
+    for (auto& span : spans)
+    {
+      first = min(first, span.start);
+      last = max(last, span.start + span.duration);
+    }
+    auto wallTime = duration<double>(last - first).count();
+
+    printf("\nstage            count     total ms       max ms\n");
+    for (auto& stage : stages())
+    {
+      printf("%-14s  %6zu  %11.1f  %11.3f\n",
+        stage.name.c_str(),
+        stage.durations.size(),
+        duration<double, milli>(accumulate(stage.durations.begin(), stage.durations.end(), clock::duration{})).count(),
+        duration<double, milli>(*max_element(stage.durations.begin(), stage.durations.end())).count());
+    }
+
+    //Busy time of each thread, overlapping spans are merged
+    unordered_map<uint32_t, vector<pair<clock::time_point, clock::time_point>>> threadIntervals;
+    for (auto& span : spans)
+    {
+      if (!span.is_outer) threadIntervals[span.thread].emplace_back(span.start, span.start + span.duration);
+    }
+
+    if (!threadIntervals.empty() && wallTime > 0.0)
+    {
+      vector<double> utilizations;
+      for (auto& [thread, intervals] : threadIntervals)
+      {
+        sort(intervals.begin(), intervals.end());
+
+        clock::duration busyTime{};
+        auto [start, end] = intervals.front();
+        for (auto& interval : intervals)
+        {
+          if (interval.first > end)
+          {
+            busyTime += end - start;
+            start = interval.first;
+          }
+          end = max(end, interval.second);
+        }
+        busyTime += end - start;
+
+        utilizations.push_back(duration<double>(busyTime).count() / wallTime);
+      }
+
+      printf("\n%zu threads were busy %.0f%% of the %.1f ms on average, the least busy %.0f%%.\n",
+        utilizations.size(),
+        accumulate(utilizations.begin(), utilizations.end(), 0.0) / utilizations.size() * 100.0,
+        wallTime * 1000.0,
+        *min_element(utilizations.begin(), utilizations.end()) * 100.0);
+    }
+
+    //Slowest variants
+    vector<const span*> variants;
+    for (auto& span : spans)
+    {
+      if (span.key) variants.push_back(&span);
+    }
+
+    auto count = min(variantCount, variants.size());
+    if (count == 0) return;
+
+    partial_sort(variants.begin(), variants.begin() + count, variants.end(), [](const span* a, const span* b) { return a->duration > b->duration; });
+
+    printf("\nslowest variants    stage            ms    thread       KB  group\n");
+    for (size_t i = 0; i < count; i++)
+    {
+      auto& span = *variants[i];
+      printf("%-18s  %-12s  %8.3f  %8u  %7.1f  %s\n",
+        FormatKey(*span.key).c_str(),
+        span.name,
+        duration<double, milli>(span.duration).count(),
+        span.thread,
+        span.bytes / 1024.0,
+        span.group.c_str());
+    }
+  }
+
+  stage_timer::stage_timer(const char* name, uint64_t bytes) noexcept :
+    _profiler(stage_profiler::current())
+  {
+    _span.name = name;
+    _span.bytes = bytes;
+    if (_profiler) _span.start = stage_profiler::clock::now();
+  }
+
+  stage_timer::~stage_timer()
+  {
+    if (!_profiler) return;
+
+    _span.duration = stage_profiler::clock::now() - _span.start;
+    _span.thread = stage_profiler::thread_index();
+    _profiler->record(move(_span));
+  }
+
+  void stage_timer::set_bytes(uint64_t bytes) noexcept
+  {
+    _span.bytes = bytes;
+  }
+
+  void stage_timer::set_key(uint64_t key) noexcept
+  {
+    _span.key = key;
+  }
+
+  void stage_timer::set_group(const std::filesystem::path& path)
+  {
+    if (_profiler && _profiler->is_tracing()) _span.group = path.string();
+  }
+
+  void stage_timer::set_outer() noexcept
+  {
+    _span.is_outer = true;
+  }
+
+  uint64_t get_peak_memory_usage()
+  {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0ull;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0ull;
+    return uint64_t(usage.ru_maxrss) * 1024ull;
+#endif
+  }
+}
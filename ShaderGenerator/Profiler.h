@@ -0,0 +1,111 @@
+#pragma once
+#include "pch.h"
+
+namespace ShaderGenerator
+{
+  //Collects the durations of the pipeline stages while installed, the benchmark mode installs one for the whole process
+  //When tracing every sample is also kept as a span, so the build can be inspected on a timeline
+  class stage_profiler
+  {
+  public:
+    typedef std::chrono::steady_clock clock;
+
+    struct stage
+    {
+      std::string name;
+      std::vector<clock::duration> durations;
+      uint64_t bytes = 0ull;
+    };
+
+    struct span
+    {
+      const char* name = nullptr;
+      clock::time_point start;
+      clock::duration duration{};
+      uint32_t thread = 0;
+      uint64_t bytes = 0ull;
+
+      //Key of the shader variant, for the stages processing a single variant
+      std::optional<uint64_t> key;
+
+      //Path of the shader group the work belongs to
+      std::string group;
+
+      //Outer spans wait for the work of other spans, such as a whole group build, so they do not count as busy time
+      bool is_outer = false;
+    };
+
+    explicit stage_profiler(bool isTracing = false);
+
+    stage_profiler(const stage_profiler&) = delete;
+    stage_profiler& operator=(const stage_profiler&) = delete;
+
+    //Returns the installed profiler or null
+    static stage_profiler* current() noexcept;
+
+    //Installs the profiler for the whole process, null removes it
+    static void install(stage_profiler* profiler) noexcept;
+
+    //Returns a small index identifying the calling thread, assigned in the order threads first ask for it
+    static uint32_t thread_index() noexcept;
+
+    bool is_tracing() const noexcept
+    {
+      return _isTracing;
+    }
+
+    void record(span&& value);
+
+    //Returns the stages in the order they were first recorded
+    std::vector<stage> stages() const;
+
+    //Returns the recorded spans in the order they finished, empty unless tracing
+    std::vector<span> spans() const;
+
+    //Writes the spans as Chrome trace events, which can be opened in chrome://tracing or Perfetto
+    void write_trace(const std::filesystem::path& path) const;
+
+    //Prints the time spent in each stage, the utilization of the threads and the slowest shader variants
+    void print_summary(size_t variantCount = 10) const;
+
+  private:
+    bool _isTracing;
+    clock::time_point _origin;
+
+    mutable std::mutex _mutex;
+    std::vector<stage> _stages;
+    std::vector<span> _spans;
+
+    static std::atomic<stage_profiler*> _current;
+  };
+
+  //Records the time spent in its scope as a sample of the stage, does nothing while no profiler is installed
+  class stage_timer
+  {
+  public:
+    explicit stage_timer(const char* name, uint64_t bytes = 0ull) noexcept;
+    ~stage_timer();
+
+    stage_timer(const stage_timer&) = delete;
+    stage_timer& operator=(const stage_timer&) = delete;
+
+    //Sets the number of bytes processed, for stages which only know it at their end
+    void set_bytes(uint64_t bytes) noexcept;
+
+    //Sets the key of the shader variant processed
+    void set_key(uint64_t key) noexcept;
+
+    //Sets the shader group the work belongs to
+    void set_group(const std::filesystem::path& path);
+
+    //Marks the scope as waiting for the work of other timers
+    void set_outer() noexcept;
+
+  private:
+    stage_profiler* _profiler;
+    stage_profiler::span _span;
+  };
+
+  //Returns the largest amount of memory the process had resident so far in bytes
+  uint64_t get_peak_memory_usage();
+}
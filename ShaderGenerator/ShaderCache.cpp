@@ -0,0 +1,259 @@
+#include "pch.h"
+#include "ShaderCache.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  const char ShaderCacheEntryMagic[4] = { 'S', 'C', 'E', '1' };
+
+  template<typename T>
+  static void WriteValue(ostream& stream, const T& value)
+  {
+    static_assert(is_trivially_copyable_v<T>);
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  static void ReadValue(istream& stream, T& value)
+  {
+    static_assert(is_trivially_copyable_v<T>);
+    stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  static void WriteArray(ostream& stream, const T& value)
+  {
+    WriteValue(stream, uint32_t(value.size()));
+    stream.write(reinterpret_cast<const char*>(value.data()), value.size());
+  }
+
+  template<typename T>
+  static void ReadArray(istream& stream, T& value)
+  {
+    uint32_t size = 0;
+    ReadValue(stream, size);
+    if (!stream.good()) return;
+
+    value.resize(size);
+    stream.read(reinterpret_cast<char*>(value.data()), size);
+  }
+
+  static uint64_t GetEntrySize(const CompiledShader& shader, const std::string& messages)
+  {
+    return shader.Data.size() + shader.PdbName.size() + shader.PdbData.size() + messages.size();
+  }
+
+  ShaderCache::ShaderCache(const std::filesystem::path& root, uint64_t sizeLimit, uint64_t memoryLimit) :
+    _root(root),
+    _sizeLimit(sizeLimit),
+    _memoryLimit(memoryLimit)
+  {
+    if (_root.empty()) return;
+
+    error_code ec;
+    create_directories(_root, ec);
+    if (ec) throw runtime_error("Failed to create shader cache directory at " + _root.string() + ".");
+  }
+
+  bool ShaderCache::TryLoad(const content_hash& key, CompiledShader& shader, std::string& messages)
+  {
+    if (TryLoadFromMemory(key, shader, messages))
+    {
+      _hits++;
+      return true;
+    }
+
+    if (_root.empty())
+    {
+      _misses++;
+      return false;
+    }
+
+    auto entryPath = GetEntryPath(key);
+
+    ifstream stream(entryPath, ios::in | ios::binary);
+    if (stream.good())
+    {
+      char magic[4];
+      stream.read(magic, sizeof(magic));
+      if (stream.good() && memcmp(magic, ShaderCacheEntryMagic, sizeof(magic)) == 0)
+      {
+        CompiledShader entry{};
+        ReadArray(stream, entry.Data);
+        ReadArray(stream, entry.PdbName);
+        ReadArray(stream, entry.PdbData);
+        ReadArray(stream, messages);
+
+        if (stream.good())
+        {
+          entry.Key = shader.Key;
+          shader = move(entry);
+          stream.close();
+
+          //Refresh the timestamp, eviction removes the least recently written entries first
+          error_code ec;
+          last_write_time(entryPath, file_time_type::clock::now(), ec);
+
+          StoreInMemory(key, shader, messages);
+
+          _hits++;
+          return true;
+        }
+      }
+    }
+
+    _misses++;
+    return false;
+  }
+
+  void ShaderCache::Store(const content_hash& key, const CompiledShader& shader, const std::string& messages)
+  {
+    StoreInMemory(key, shader, messages);
+    if (_root.empty())
+    {
+      _stores++;
+      return;
+    }
+
+    auto entryPath = GetEntryPath(key);
+
+    error_code ec;
+    create_directory(entryPath.parent_path(), ec);
+    if (ec) return;
+
+    //Write to a temporary file first, so concurrent readers never see partial entries
+    stringstream temporaryName;
+    temporaryName << entryPath.filename().string() << "." << this_thread::get_id() << ".tmp";
+    auto temporaryPath = entryPath.parent_path() / temporaryName.str();
+
+    {
+      ofstream stream(temporaryPath, ios::out | ios::binary | ios::trunc);
+      if (!stream.good()) return;
+
+      stream.write(ShaderCacheEntryMagic, sizeof(ShaderCacheEntryMagic));
+      WriteArray(stream, shader.Data);
+      WriteArray(stream, shader.PdbName);
+      WriteArray(stream, shader.PdbData);
+      WriteArray(stream, messages);
+
+      if (!stream.good())
+      {
+        stream.close();
+        remove(temporaryPath, ec);
+        return;
+      }
+    }
+
+    rename(temporaryPath, entryPath, ec);
+    if (ec)
+    {
+      remove(temporaryPath, ec);
+    }
+    else
+    {
+      _stores++;
+    }
+  }
+
+  void ShaderCache::Trim()
+  {
+    if (_root.empty()) return;
+
+    struct CacheEntry
+    {
+      path Path;
+      uint64_t Size;
+      file_time_type Time;
+    };
+
+    //Collect entries
+    vector<CacheEntry> entries;
+    uint64_t totalSize = 0;
+
+    error_code ec;
+    for (auto& item : recursive_directory_iterator(_root, ec))
+    {
+      if (!item.is_regular_file(ec)) continue;
+
+      CacheEntry entry{ item.path(), item.file_size(ec), item.last_write_time(ec) };
+      if (ec) continue;
+
+      totalSize += entry.Size;
+      entries.push_back(move(entry));
+    }
+
+    if (totalSize <= _sizeLimit) return;
+
+    //Remove the least recently used entries until we fit into the limit
+    sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) { return a.Time < b.Time; });
+
+    size_t evictedCount = 0;
+    for (auto& entry : entries)
+    {
+      if (totalSize <= _sizeLimit) break;
+
+      if (remove(entry.Path, ec))
+      {
+        totalSize -= entry.Size;
+        evictedCount++;
+      }
+    }
+
+    printf("Shader cache: evicted %zu entries, %.1f MB in use.\n", evictedCount, totalSize / 1024.0 / 1024.0);
+  }
+
+  void ShaderCache::PrintStatistics() const
+  {
+    size_t hits = _hits, misses = _misses, stores = _stores;
+    auto lookups = hits + misses;
+    printf("Shader cache: %zu hits, %zu misses (%.1f%% hit rate), %zu new entries.\n", hits, misses, lookups ? hits * 100.0 / lookups : 0.0, stores);
+  }
+
+  std::filesystem::path ShaderCache::GetEntryPath(const content_hash& key) const
+  {
+    auto name = key.to_string();
+    return _root / name.substr(0, 2) / name;
+  }
+
+  bool ShaderCache::TryLoadFromMemory(const content_hash& key, CompiledShader& shader, std::string& messages)
+  {
+    if (!_memoryLimit) return false;
+
+    lock_guard<mutex> lock(_memoryMutex);
+    auto entry = _memoryEntries.find(key);
+    if (entry == _memoryEntries.end()) return false;
+
+    //Move to the front of the recently used list
+    _memoryOrder.splice(_memoryOrder.begin(), _memoryOrder, entry->second.Position);
+
+    auto shaderKey = shader.Key;
+    shader = entry->second.Shader;
+    shader.Key = shaderKey;
+    messages = entry->second.Messages;
+    return true;
+  }
+
+  void ShaderCache::StoreInMemory(const content_hash& key, const CompiledShader& shader, const std::string& messages)
+  {
+    auto size = GetEntrySize(shader, messages);
+    if (size > _memoryLimit) return;
+
+    lock_guard<mutex> lock(_memoryMutex);
+    if (_memoryEntries.contains(key)) return;
+
+    //Evict least recently used entries
+    while (_memorySize + size > _memoryLimit)
+    {
+      auto& evicted = _memoryEntries.at(_memoryOrder.back());
+      _memorySize -= GetEntrySize(evicted.Shader, evicted.Messages);
+      _memoryEntries.erase(_memoryOrder.back());
+      _memoryOrder.pop_back();
+    }
+
+    _memoryOrder.push_front(key);
+    _memoryEntries.emplace(key, MemoryEntry{ shader, messages, _memoryOrder.begin() });
+    _memorySize += size;
+  }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "ShaderCompiler.h"
+#include "Hash.h"
+
+namespace ShaderGenerator
+{
+  //Content addressed store of compiled shader variants, kept on disk and optionally in memory
+  class ShaderCache
+  {
+  public:
+    inline static const uint64_t DefaultSizeLimit = 1024ull * 1024ull * 1024ull;
+    inline static const uint64_t DefaultMemoryLimit = 512ull * 1024ull * 1024ull;
+
+    //An empty root disables the on-disk store, a zero memory limit disables the in-memory store
+    ShaderCache(const std::filesystem::path& root, uint64_t sizeLimit = DefaultSizeLimit, uint64_t memoryLimit = 0ull);
+
+    //Loads the bytecode, debug symbols and compiler messages stored for the key, the shader key is left untouched
+    bool TryLoad(const content_hash& key, CompiledShader& shader, std::string& messages);
+
+    void Store(const content_hash& key, const CompiledShader& shader, const std::string& messages);
+
+    //Evicts least recently used entries until the cache fits into its size limit
+    void Trim();
+
+    void PrintStatistics() const;
+
+  private:
+    struct MemoryEntry
+    {
+      CompiledShader Shader;
+      std::string Messages;
+      std::list<content_hash>::iterator Position;
+    };
+
+    std::filesystem::path _root;
+    uint64_t _sizeLimit;
+
+    std::mutex _memoryMutex;
+    uint64_t _memoryLimit, _memorySize = 0ull;
+    std::list<content_hash> _memoryOrder;
+    std::unordered_map<content_hash, MemoryEntry> _memoryEntries;
+
+    std::atomic<size_t> _hits = 0, _misses = 0, _stores = 0;
+
+    std::filesystem::path GetEntryPath(const content_hash& key) const;
+
+    bool TryLoadFromMemory(const content_hash& key, CompiledShader& shader, std::string& messages);
+    void StoreInMemory(const content_hash& key, const CompiledShader& shader, const std::string& messages);
+  };
+}
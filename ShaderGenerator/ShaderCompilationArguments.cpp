@@ -7,12 +7,73 @@ namespace ShaderGenerator
 {
   ShaderCompilationArguments ShaderCompilationArguments::Parse(int argc, char* argv[])
   {
-    regex argRegex("-(\\w+)(?:=(.*))?");
+    auto result = Parse(vector<string>(argv, argv + argc), {});
 
-    ShaderCompilationArguments result{};
-    for (int index = 0; index < argc; index++)
+    if (result.Input.empty() && result.Manifest.empty() && result.Benchmark.empty())
+    {
+      throw runtime_error("Please specify an input file using -i=<file> or a manifest using -m=<file>.");
+    }
+    return result;
+  }
+
+  std::vector<ShaderCompilationArguments> ShaderCompilationArguments::ParseManifest(const std::filesystem::path& path, const ShaderCompilationArguments& defaults)
+  {
+    ifstream file(path);
+    if (!file.good())
+    {
+      throw runtime_error(("Failed to open manifest " + path.string()).c_str());
+    }
+
+    //Arguments are separated by whitespace, double quotes may be used for values containing spaces
+    static regex tokenRegex("(?:[^\\s\"]|\"[^\"]*\")+");
+    static regex quoteRegex("\"");
+
+    //The compilation cache is shared by every group of the process, so it is only configured on the command line
+    static regex cacheArgRegex("--?(c|cl|nc)(?:=.*)?");
+
+    vector<ShaderCompilationArguments> results;
+    string line;
+    while (getline(file, line))
+    {
+      if (results.empty() && line.starts_with("\xEF\xBB\xBF")) line.erase(0, 3);
+
+      vector<string> args;
+      for (sregex_iterator it(line.begin(), line.end(), tokenRegex), end; it != end; it++)
+      {
+        args.push_back(regex_replace(it->str(), quoteRegex, ""));
+      }
+      if (args.empty()) continue;
+
+      if (any_of(args.begin(), args.end(), [](const string& arg) { return regex_match(arg, cacheArgRegex); }))
+      {
+        throw runtime_error(("Manifest lines cannot set the compilation cache, pass -c, -cl and -nc on the command line: " + line).c_str());
+      }
+
+      auto groupDefaults = defaults;
+      groupDefaults.Input.clear();
+      groupDefaults.Output.clear();
+      groupDefaults.Header.clear();
+      groupDefaults.Manifest.clear();
+
+      auto result = Parse(args, groupDefaults);
+      if (result.Input.empty())
+      {
+        throw runtime_error(("Manifest line is missing an input file: " + line).c_str());
+      }
+
+      results.push_back(move(result));
+    }
+
+    return results;
+  }
+
+  ShaderCompilationArguments ShaderCompilationArguments::Parse(const std::vector<std::string>& args, ShaderCompilationArguments result)
+  {
+    //Long options such as --trace may also be written with two dashes
+    regex argRegex("--?(\\w+)(?:=(.*))?");
+
+    for (auto& arg : args)
     {
-      auto arg = string(argv[index]);
       smatch match;
       if (regex_match(arg, match, argRegex))
       {
@@ -56,12 +117,74 @@ namespace ShaderGenerator
         {
           result.WaitForDebugger = true;
         }
+        else if (match[1] == "c")
+        {
+          result.CacheDirectory = string(match[2]);
+        }
+        else if (match[1] == "cl")
+        {
+          result.CacheSizeLimit = stoull(match[2]) * 1024ull * 1024ull;
+        }
+        else if (match[1] == "nc")
+        {
+          result.IsCacheEnabled = false;
+        }
+        else if (match[1] == "j")
+        {
+          result.ThreadCount = stoull(match[2]);
+        }
+        else if (match[1] == "m")
+        {
+          result.Manifest = string(match[2]);
+        }
+        else if (match[1] == "b")
+        {
+          result.Backend = match[2];
+        }
+        else if (match[1] == "w")
+        {
+          result.IsWatching = true;
+          if (match[2].matched && match[2].length() > 0) result.PipeName = match[2];
+        }
+        else if (match[1] == "z")
+        {
+          auto dictionarySize = result.Compression.DictionarySize;
+          result.Compression = BlockCompressionSettings::Parse(match[2]);
+          result.Compression.DictionarySize = dictionarySize;
+        }
+        else if (match[1] == "zd")
+        {
+          result.Compression.DictionarySize = (match[2].matched && match[2].length() > 0 ? stoull(match[2]) : 64ull) * 1024ull;
+        }
+        else if (match[1] == "bs")
+        {
+          result.Layout.BlockSize = stoull(match[2]) * 1024ull;
+        }
+        else if (match[1] == "a")
+        {
+          result.Layout.AccessTrace = string(match[2]);
+        }
+        else if (match[1] == "bench")
+        {
+          result.Benchmark = match[2].matched && match[2].length() > 0 ? string(match[2]) : "8x3";
+        }
+        else if (match[1] == "r")
+        {
+          result.Report = string(match[2]);
+        }
+        else if (match[1] == "trace")
+        {
+          result.Trace = string(match[2]);
+        }
       }
     }
 
-    if (result.Input.empty())
+    //The cache is an intermediate, so it is kept out of the output directory which might be deployed
+    if (result.CacheDirectory.empty())
     {
-      throw exception("Please specify an input file using -i=<file>.");
+      error_code ec;
+      auto tempDirectory = filesystem::temp_directory_path(ec);
+      if (!ec) result.CacheDirectory = tempDirectory / "ShaderGeneratorCache";
     }
     return result;
   }
@@ -1,18 +1,43 @@
 #pragma once
 #include "pch.h"
+#include "BlockCompression.h"
+#include "ShaderLayout.h"
 
 namespace ShaderGenerator
 {
   struct ShaderCompilationArguments
   {
-    std::filesystem::path Input, Output, Header;
+    std::filesystem::path Input, Output, Header, Manifest;
     bool IsDebug = false;
     bool UseExternalDebugSymbols = false;
     int OptimizationLevel = 2;
     std::string NamespaceName;
     bool WaitForDebugger = false;
+    std::filesystem::path CacheDirectory;
+    uint64_t CacheSizeLimit = 1024ull * 1024ull * 1024ull;
+    bool IsCacheEnabled = true;
+    size_t ThreadCount = 0;
+    std::string Backend;
+    bool IsWatching = false;
+    std::string PipeName = "ShaderGenerator";
+    BlockCompressionSettings Compression;
+    ShaderLayoutSettings Layout;
 
+    //Option value counts of the synthetic group built in benchmark mode, such as 6x2,4 for six options of two values and one of four
+    std::string Benchmark;
+
+    //JSON report written by the benchmark mode
+    std::filesystem::path Report;
+
+    //Chrome trace of every stage and shader variant, written once the generator finishes
+    std::filesystem::path Trace;
 
     static ShaderCompilationArguments Parse(int argc, char* argv[]);
+
+    //Parses a manifest file, each line holds the arguments of a shader group, the provided defaults apply to every line
+    static std::vector<ShaderCompilationArguments> ParseManifest(const std::filesystem::path& path, const ShaderCompilationArguments& defaults);
+
+  private:
+    static ShaderCompilationArguments Parse(const std::vector<std::string>& args, ShaderCompilationArguments result);
   };
 }
\ No newline at end of file
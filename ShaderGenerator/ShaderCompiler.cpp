@@ -1,9 +1,12 @@
 #include "pch.h"
 #include "ShaderCompiler.h"
+#include "ShaderCache.h"
+#include "ShaderCompilerBackend.h"
 #include "Parallel.h"
+#include "SourceFileCache.h"
+#include "Profiler.h"
 
 using namespace std;
-using namespace winrt;
 
 namespace ShaderGenerator
 {
@@ -12,161 +15,209 @@ namespace ShaderGenerator
     const ShaderInfo* Shader;
     const ShaderCompilationArguments* Options;
     const vector<OptionPermutation>* Input;
-    bool IsFailed = false;
+    ShaderCache* Cache;
+    ShaderCompilerBackend* Backend;
+    shared_ptr<const string> Source;
+    atomic<bool> IsFailed = false;
 
     mutex MessagesMutex;
-    vector<CompiledShader> Output;
     unordered_set<string> Messages;
 
-    ShaderCompilationContext(const ShaderInfo& info, const ShaderCompilationArguments& options, const vector<OptionPermutation>& permutations) :
+    ShaderCompilationContext(const ShaderInfo& info, const ShaderCompilationArguments& options, const vector<OptionPermutation>& permutations, ShaderCache* cache, ShaderCompilerBackend* backend) :
       Shader(&info),
       Options(&options),
-      Input(&permutations)
+      Input(&permutations),
+      Cache(cache),
+      Backend(backend)
     { }
   };
 
-  CompiledShader CompileShaderPermutation(const OptionPermutation& permutation, ShaderCompilationContext& context)
+  struct PreprocessedPermutation
   {
-    //Define result
-    CompiledShader result{};
-    result.Key = permutation.Key;
+    bool IsPreprocessed = false;
+    content_hash SourceHash;
+  };
 
-    //Define macros
-    vector<D3D_SHADER_MACRO> macros;
-    for (auto& define : permutation.Defines)
-    {
-      macros.push_back({ define.first.c_str(), define.second.c_str() });
-    }
-    macros.push_back({ nullptr, nullptr });
+  PreprocessedPermutation PreprocessPermutation(const OptionPermutation& permutation, const ShaderCompilationContext& context)
+  {
+    stage_timer timer{ "preprocess" };
+    timer.set_key(permutation.Key);
+    timer.set_group(context.Shader->Path);
 
-    //Define compilation flags
-    auto flags = 0u;
-    if (context.Options->IsDebug)
-    {
-      flags |= D3DCOMPILE_DEBUG | D3DCOMPILE_DEBUG_NAME_FOR_BINARY;
-    }
+    PreprocessedPermutation result{};
+    result.IsPreprocessed = context.Backend->Preprocess(*context.Shader, *context.Source, permutation, result.SourceHash);
+    return result;
+  }
 
-    switch (context.Options->OptimizationLevel)
+  content_hash GetCacheKey(const OptionPermutation& permutation, const PreprocessedPermutation& preprocessed, const ShaderCompilationContext& context)
+  {
+    //Hash everything which affects the output
+    content_hasher hasher;
+    hasher.add_value(preprocessed.SourceHash);
+    for (auto& [name, value] : permutation.Defines)
     {
-    case -1:
-      flags |= D3DCOMPILE_SKIP_OPTIMIZATION;
-      break;
-    case 0:
-      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL0;
-      break;
-    case 1:
-      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL1;
-      break;
-    case 2:
-      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL2;
-      break;
-    case 3:
-      flags |= D3DCOMPILE_OPTIMIZATION_LEVEL3;
-      break;
+      hasher.add(name);
+      hasher.add(value);
     }
+    hasher.add(context.Shader->Target);
+    hasher.add(context.Shader->EntryPoint);
+    hasher.add_value(context.Options->IsDebug);
+    hasher.add_value(context.Options->OptimizationLevel);
+    hasher.add_value(context.Options->UseExternalDebugSymbols);
+    hasher.add(context.Backend->Identity());
+
+    return hasher.finish();
+  }
 
-    //Run compilation
-    com_ptr<ID3DBlob> binary, errors;
-    auto success = SUCCEEDED(D3DCompileFromFile(
-      context.Shader->Path.c_str(),
-      macros.data(),
-      D3D_COMPILE_STANDARD_FILE_INCLUDE,
-      context.Shader->EntryPoint.c_str(),
-      context.Shader->Target.c_str(),
-      flags,
-      0u,
-      binary.put(),
-      errors.put()));
-
-    //Post process results
-    if (success)
+  void PrintMessages(const string& text, ShaderCompilationContext& context)
+  {
+    stringstream messages{ text };
+    string message;
+    static regex warningIgnoreRegex(".*: warning X3568: '(target|namespace|entry|option|constraint|exclude)' : unknown pragma ignored");
     {
-      //Get debug information
-      if(context.Options->IsDebug && context.Options->UseExternalDebugSymbols)
+      while (getline(messages, message, '\n'))
       {
-        com_ptr<ID3DBlob> pdb;
-        D3DGetBlobPart(binary->GetBufferPointer(), binary->GetBufferSize(), D3D_BLOB_PDB, 0, pdb.put());
-
-        com_ptr<ID3DBlob> pdbName;
-        D3DGetBlobPart(binary->GetBufferPointer(), binary->GetBufferSize(), D3D_BLOB_DEBUG_NAME, 0, pdbName.put());
-
-        if (pdb && pdbName)
+        lock_guard<mutex> lock(context.MessagesMutex);
+        if (!regex_match(message, warningIgnoreRegex) && context.Messages.emplace(message).second)
         {
-          struct ShaderDebugName
-          {
-            uint16_t Flags;
-            uint16_t NameLength;
-          };
+          printf("%s\n", message.c_str());
+        }
+      }
+    }
+  }
 
-          auto pDebugNameData = reinterpret_cast<const ShaderDebugName*>(pdbName->GetBufferPointer());
-          auto fileName = reinterpret_cast<const char*>(pDebugNameData + 1);
+  CompiledShader CompileShaderPermutation(const OptionPermutation& permutation, const PreprocessedPermutation& preprocessed, ShaderCompilationContext& context)
+  {
+    //Cache hits are measured as well, the benchmark mode disables the cache
+    stage_timer timer{ "compile" };
+    timer.set_key(permutation.Key);
+    timer.set_group(context.Shader->Path);
 
-          result.PdbName = fileName;
-          result.PdbData.resize(pdb->GetBufferSize());
-          memcpy(result.PdbData.data(), pdb->GetBufferPointer(), pdb->GetBufferSize());
-        }
+    //Define result
+    CompiledShader result{};
+    result.Key = permutation.Key;
 
-        com_ptr<ID3DBlob> stripped;
-        D3DStripShader(binary->GetBufferPointer(), binary->GetBufferSize(), D3DCOMPILER_STRIP_DEBUG_INFO, stripped.put());
-        swap(binary, stripped);
-      }
+    //Check cache
+    content_hash cacheKey;
+    auto isCacheable = context.Cache && preprocessed.IsPreprocessed;
+    if (isCacheable)
+    {
+      cacheKey = GetCacheKey(permutation, preprocessed, context);
 
-      //Store binary
+      string messages;
+      if (context.Cache->TryLoad(cacheKey, result, messages))
       {
-        result.Data.resize(binary->GetBufferSize());
-        memcpy(result.Data.data(), binary->GetBufferPointer(), binary->GetBufferSize());
+        timer.set_bytes(result.Data.size());
+        PrintMessages(messages, context);
+        return result;
       }
     }
-      
-    //Print out messages
-    stringstream messages{ string((char*)errors->GetBufferPointer(), size_t(errors->GetBufferSize())) };
-    string message;
-    static regex warningIgnoreRegex(".*: warning X3568: '(target|namespace|entry|option)' : unknown pragma ignored");
+
+    //Run compilation
+    string messages;
+    auto success = context.Backend->Compile(*context.Shader, *context.Source, permutation, *context.Options, result, messages);
+
+    //Separate debug information
+    if (success && context.Options->IsDebug && context.Options->UseExternalDebugSymbols)
     {
-      while (getline(messages, message, '\n'))
-      {
-        if (!regex_match(message, warningIgnoreRegex) && context.Messages.emplace(message).second)
-        {
-          lock_guard<mutex> lock(context.MessagesMutex);
-          printf("%s\n", message.c_str());
-        }
-      }
+      context.Backend->ExtractDebugSymbols(result);
+      context.Backend->StripDebugSymbols(result);
     }
 
-    //If not successful set failed flag
+    //Print out messages
+    timer.set_bytes(result.Data.size());
+    PrintMessages(messages, context);
+
+    //If not successful set failed flag, otherwise update cache
     if (!success)
     {
       context.IsFailed = true;
     }
+    else if (isCacheable)
+    {
+      context.Cache->Store(cacheKey, result, messages);
+    }
 
     return result;
   }
 
-  vector<CompiledShader> CompileShader(const ShaderInfo& shader, const ShaderCompilationArguments& options)
+  bool CompileShader(const ShaderInfo& shader, const ShaderCompilationArguments& options, ShaderCache* cache, CompiledShaderSink& sink)
   {
-    auto permutations = ShaderOption::Permutate(shader.Options);
-    ShaderCompilationContext context{shader, options, permutations};
+    vector<OptionPermutation> permutations;
+    {
+      stage_timer timer{ "permutate" };
+      timer.set_group(shader.Path);
+      permutations = ShaderOption::Permutate(shader.Options, shader.Constraints);
+    }
+    if (permutations.empty()) throw runtime_error("The constraints of " + shader.Path.string() + " exclude every shader variant.");
+
+    auto backend = CreateShaderCompilerBackend(options.Backend);
+    ShaderCompilationContext context{shader, options, permutations, cache, backend.get()};
+    context.Source = SourceFileCache::Shared().Read(shader.Path);
+    if (!context.Source) throw runtime_error("Failed to read shader source " + shader.Path.string() + ".");
 
     printf("Compiling %s at optimization level %d", shader.Path.string().c_str(), options.OptimizationLevel);
     if (options.IsDebug) printf(" with debug symbols");
-    printf("...\n Generating %zu shader variants.\n", permutations.size());
+    printf("...\n Generating %zu shader variants", permutations.size());
+    if (!shader.Constraints.empty()) printf(", %zu excluded by constraints", ShaderOption::CountPermutations(shader.Options) - permutations.size());
+    printf(".\n");
 
-    context.Output = parallel_map<OptionPermutation, CompiledShader>(*context.Input,
-      [&](const OptionPermutation& permutation) 
-      { 
-        return CompileShaderPermutation(permutation, context); 
+    //Preprocess permutations
+    auto preprocessed = parallel_map<OptionPermutation, PreprocessedPermutation>(*context.Input,
+      [&](const OptionPermutation& permutation)
+      {
+        return PreprocessPermutation(permutation, context);
       }
     );
 
-    if (context.IsFailed)
+    //Collapse permutations with identical preprocessed source, as they compile to the same output
+    vector<size_t> uniqueIndices;
+    vector<size_t> representatives(permutations.size());
     {
-      printf("Shader group compilation failed.\n");
-      return {};
+      unordered_map<content_hash, size_t> sources;
+      for (size_t index = 0; index < permutations.size(); index++)
+      {
+        if (preprocessed[index].IsPreprocessed)
+        {
+          auto [source, isNew] = sources.emplace(preprocessed[index].SourceHash, index);
+          if (!isNew)
+          {
+            representatives[index] = source->second;
+            continue;
+          }
+        }
+
+        representatives[index] = index;
+        uniqueIndices.push_back(index);
+      }
     }
-    else
+    printf(" Compiling %zu unique variants.\n", uniqueIndices.size());
+
+    //Compile unique permutations, the sink consumes them as they finish
+    sink.Begin(permutations, representatives);
+    try
+    {
+      parallel_for(uniqueIndices.size(), [&](size_t index) {
+        auto permutationIndex = uniqueIndices[index];
+        auto result = CompileShaderPermutation(permutations[permutationIndex], preprocessed[permutationIndex], context);
+        if (!context.IsFailed) sink.Add(permutationIndex, move(result));
+      });
+    }
+    catch (...)
+    {
+      sink.Abort();
+      throw;
+    }
+
+    if (context.IsFailed)
     {
-      printf("Shader group compilation succeeded.\n");
-      return move(context.Output);
+      sink.Abort();
+      printf("Shader group %s compilation failed.\n", shader.Path.string().c_str());
+      return false;
     }
+
+    sink.Finish();
+    printf("Shader group %s compilation succeeded.\n", shader.Path.string().c_str());
+    return true;
   }
 }
@@ -13,5 +13,27 @@ namespace ShaderGenerator
     std::vector<uint8_t> PdbData;
   };
 
-  std::vector<CompiledShader> CompileShader(const ShaderInfo& shader, const ShaderCompilationArguments& options = {});
+  class ShaderCache;
+
+  //Receives compiled variants while the rest of the group is still compiling
+  class CompiledShaderSink
+  {
+  public:
+    //Called before compilation, representatives holds the index of the permutation each permutation compiles identically to
+    virtual void Begin(const std::vector<OptionPermutation>& permutations, const std::vector<size_t>& representatives) = 0;
+
+    //Called concurrently from the compilation threads, once for each permutation which is its own representative
+    virtual void Add(size_t index, CompiledShader&& shader) = 0;
+
+    //Called after every variant is added
+    virtual void Finish() = 0;
+
+    //Called instead of Finish if the compilation failed
+    virtual void Abort() = 0;
+
+    virtual ~CompiledShaderSink() = default;
+  };
+
+  //Compiles every variant of the shader into the sink, returns false if any of them failed to compile
+  bool CompileShader(const ShaderInfo& shader, const ShaderCompilationArguments& options, ShaderCache* cache, CompiledShaderSink& sink);
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "ShaderCompilerBackend.h"
+#include "D3DCompilerBackend.h"
+#include "ExternalCompilerBackend.h"
+#include "FakeCompilerBackend.h"
+#include "SourceFileCache.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  content_hash ShaderCompilerBackend::HashSources(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation)
+  {
+    content_hasher hasher;
+    hasher.add(source);
+
+    //Dependencies are collected into a set, sort them so the hash is stable
+    auto dependencies = shader.Dependencies;
+    sort(dependencies.begin(), dependencies.end());
+    for (auto& dependency : dependencies)
+    {
+      auto content = SourceFileCache::Shared().Read(dependency);
+      hasher.add(dependency.generic_string());
+      hasher.add(content ? *content : string());
+    }
+
+    for (auto& [name, value] : permutation.Defines)
+    {
+      hasher.add(name);
+      hasher.add(value);
+    }
+
+    return hasher.finish();
+  }
+
+  std::unique_ptr<ShaderCompilerBackend> CreateShaderCompilerBackend(const std::string& name)
+  {
+    static regex fakeRegex("fake(?::(\\d+))?(?::(\\d+))?(?::(uniform|lognormal))?");
+
+    smatch match;
+    if (name.empty() || name == "d3d")
+    {
+#ifdef _WIN32
+      return make_unique<D3DCompilerBackend>();
+#else
+      throw runtime_error("The D3D compiler is not available on this platform, please select a compiler using -b=<compiler>.");
+#endif
+    }
+    else if (regex_match(name, match, fakeRegex))
+    {
+      FakeCompilerBackend::Settings settings{};
+      if (match[1].matched) settings.Latency = chrono::milliseconds(stoull(match[1]));
+      if (match[2].matched) settings.Size = stoull(match[2]);
+      if (match[3].matched && match[3] == "lognormal") settings.Distribution = FakeCompilerBackend::SizeDistribution::LogNormal;
+      return make_unique<FakeCompilerBackend>(settings);
+    }
+    else
+    {
+      return make_unique<ExternalCompilerBackend>(path(name));
+    }
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "ShaderCompiler.h"
+#include "Hash.h"
+
+namespace ShaderGenerator
+{
+  //Compiles shader variants for the pipeline, implementations must be safe to call from multiple threads
+  class ShaderCompilerBackend
+  {
+  public:
+    //Identifies the compiler and its version, the compilation cache is keyed by it
+    virtual std::string Identity() const = 0;
+
+    //Hashes the input of a variant, variants with the same hash must compile to the same output
+    virtual bool Preprocess(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, content_hash& sourceHash) = 0;
+
+    //Compiles a variant into result.Data, errors and warnings are returned in messages
+    virtual bool Compile(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation, const ShaderCompilationArguments& options, CompiledShader& result, std::string& messages) = 0;
+
+    //Copies the debug symbols embedded in the bytecode into PdbName and PdbData
+    virtual void ExtractDebugSymbols(CompiledShader& shader) = 0;
+
+    //Removes the debug symbols embedded in the bytecode
+    virtual void StripDebugSymbols(CompiledShader& shader) = 0;
+
+    virtual ~ShaderCompilerBackend() = default;
+
+  protected:
+    //Hashes the source, its includes and the defines, for backends which cannot preprocess in-process
+    static content_hash HashSources(const ShaderInfo& shader, const std::string& source, const OptionPermutation& permutation);
+  };
+
+  //Creates a backend from its command line name, an empty name selects the default backend of the platform
+  std::unique_ptr<ShaderCompilerBackend> CreateShaderCompilerBackend(const std::string& name);
+}
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "ShaderConfiguration.h"
 #include "FileAttributes.h"
+#include "Profiler.h"
 
 using namespace std;
 
@@ -36,7 +37,7 @@ namespace ShaderGenerator
 
       if (result->Values.size() == 0)
       {
-        throw exception("Enum options must have at least one value!");
+        throw runtime_error("Enum options must have at least one value!");
       }
 
       return result;
@@ -50,7 +51,7 @@ namespace ShaderGenerator
 
       if (result->Minimum > result->Maximum)
       {
-        throw exception("Integer option maximum must be greater than minimum!");
+        throw runtime_error("Integer option maximum must be greater than minimum!");
       }
 
       return result;
@@ -75,7 +76,7 @@ namespace ShaderGenerator
       ifstream file(dependenciesToCheck.front());
       if (!file.good())
       {
-        throw std::exception(("Failed to open file " + path.string()).c_str());
+        throw std::runtime_error(("Failed to open file " + path.string()).c_str());
       }
 
       string line;
@@ -103,22 +104,30 @@ namespace ShaderGenerator
     ShaderInfo result{};
     result.Path = path;
 
-    auto dependencies = GetDependencies(path);
-    result.Dependencies = { dependencies.begin(), dependencies.end() };
-
-    result.InputTimestamp = {};
-    for (auto& dependency : result.Dependencies)
     {
-      result.InputTimestamp = max(result.InputTimestamp, get_file_time(dependency, file_time_kind::modification));
+      stage_timer timer{ "scan" };
+      timer.set_group(path);
+
+      auto dependencies = GetDependencies(path);
+      result.Dependencies = { dependencies.begin(), dependencies.end() };
+
+      result.InputTimestamp = {};
+      result.DependencyTimestamps.reserve(result.Dependencies.size());
+      for (auto& dependency : result.Dependencies)
+      {
+        result.DependencyTimestamps.push_back(get_file_time(dependency, file_time_kind::modification));
+        result.InputTimestamp = max(result.InputTimestamp, result.DependencyTimestamps.back());
+      }
     }
 
-    static regex optionRegex("#pragma\\s+(target|namespace|entry|option)\\s+(.*)");
+    static regex optionRegex("#pragma\\s+(target|namespace|entry|option|constraint|exclude)\\s+(.*)");
     ifstream file(path);
     if (!file.good())
     {
-      throw std::exception(("Failed to open file " + path.string()).c_str());
+      throw std::runtime_error(("Failed to open file " + path.string()).c_str());
     }
 
+    vector<pair<string, bool>> constraints;
     string line;
     while (getline(file, line))
     {
@@ -142,9 +151,19 @@ namespace ShaderGenerator
           auto option = ParseOption(match[2]);
           if (option) result.Options.push_back(move(option));
         }
+        else
+        {
+          constraints.emplace_back(match[2], match[1] == "exclude");
+        }
       }
     }
 
+    //Constraints may refer to options declared after them
+    for (auto& [text, isExclusion] : constraints)
+    {
+      result.Constraints.push_back(ShaderConstraint::Parse(text, isExclusion, result.Options));
+    }
+
     return result;
   }
 
@@ -155,6 +174,10 @@ namespace ShaderGenerator
     text << "\n";
     text << "namespace " << namespaceName.c_str() << "\n";
     text << "{\n";
+    for (auto& constraint : Constraints)
+    {
+      text << "  //" << (constraint.IsExclusion ? "Excluded: " : "Constraint: ") << constraint.Text << "\n";
+    }
     text << "  enum class " << Path.filename().replace_extension().string().c_str() << "Flags : unsigned long long\n";
     text << "  {\n";
     text << "    Default = 0,\n";
@@ -200,7 +223,7 @@ namespace ShaderGenerator
     return range > 0 ? (size_t)ceil(log2(float(range))) : 0;
   }
 
-  std::vector<OptionPermutation> ShaderOption::Permutate(const std::vector<std::unique_ptr<ShaderOption>>& options)
+  std::vector<OptionPermutation> ShaderOption::Permutate(const std::vector<std::unique_ptr<ShaderOption>>& options, const std::vector<ShaderConstraint>& constraints)
   {
     //If there are no options, there is a single empty permutation
     if (options.empty())
@@ -208,16 +231,9 @@ namespace ShaderGenerator
       return { {} };
     }
 
-    //Count permutations
-    size_t permutationCount = 1;
-    for (auto& option : options)
-    {
-      permutationCount *= option->ValueCount();
-    }
-
-    //Create result buffer
+    //Create result buffer, constraints might exclude most permutations
     vector<OptionPermutation> results;
-    results.reserve(permutationCount);
+    if (constraints.empty()) results.reserve(CountPermutations(options));
 
     //Create index buffer
     vector<size_t> indices(options.size());
@@ -227,28 +243,31 @@ namespace ShaderGenerator
     auto done = false;
     while (!done)
     {
-      //Emit result
-      OptionPermutation value{};
-      size_t offset = 0;
-      for (size_t i = 0; i < options.size(); i++)
+      //Emit result, unless a constraint excludes it
+      if (all_of(constraints.begin(), constraints.end(), [&](const ShaderConstraint& constraint) { return constraint.Allows(indices); }))
       {
-        auto& option = options[i];
-
-        string definedValue;
-        if (option->TryGetDefinedValue(indices[i], definedValue))
+        OptionPermutation value{};
+        size_t offset = 0;
+        for (size_t i = 0; i < options.size(); i++)
         {
-          value.Defines.push_back({ option->Name + definedValue, "1" });
+          auto& option = options[i];
 
-          if (option->IsValueDefinedExplicitly())
+          string definedValue;
+          if (option->TryGetDefinedValue(indices[i], definedValue))
           {
-            value.Defines.push_back({ option->Name, definedValue });
+            value.Defines.push_back({ option->Name + definedValue, "1" });
+
+            if (option->IsValueDefinedExplicitly())
+            {
+              value.Defines.push_back({ option->Name, definedValue });
+            }
           }
-        }
 
-        value.Key |= indices[i] << offset;
-        offset += option->KeyLength();
+          value.Key |= indices[i] << offset;
+          offset += option->KeyLength();
+        }
+        results.push_back(move(value));
       }
-      results.push_back(move(value));
 
       //Increment indices
       indices[currentIndex]++;
@@ -282,6 +301,250 @@ namespace ShaderGenerator
     return results;
   }
 
+  size_t ShaderOption::CountPermutations(const std::vector<std::unique_ptr<ShaderOption>>& options)
+  {
+    size_t result = 1;
+    for (auto& option : options)
+    {
+      result *= option->ValueCount();
+    }
+    return result;
+  }
+
+  bool ShaderConstraint::Allows(const std::vector<size_t>& indices) const
+  {
+    array<bool, MaxDepth> stack;
+    size_t depth = 0;
+    for (auto& instruction : Program)
+    {
+      auto value = int64_t(indices[instruction.Option]);
+      switch (instruction.Operation)
+      {
+      case ConstraintOperation::Equal:
+        stack[depth++] = value == instruction.Value;
+        break;
+      case ConstraintOperation::NotEqual:
+        stack[depth++] = value != instruction.Value;
+        break;
+      case ConstraintOperation::Less:
+        stack[depth++] = value < instruction.Value;
+        break;
+      case ConstraintOperation::LessOrEqual:
+        stack[depth++] = value <= instruction.Value;
+        break;
+      case ConstraintOperation::Greater:
+        stack[depth++] = value > instruction.Value;
+        break;
+      case ConstraintOperation::GreaterOrEqual:
+        stack[depth++] = value >= instruction.Value;
+        break;
+      case ConstraintOperation::Not:
+        stack[depth - 1] = !stack[depth - 1];
+        break;
+      case ConstraintOperation::And:
+        depth--;
+        stack[depth - 1] = stack[depth - 1] && stack[depth];
+        break;
+      case ConstraintOperation::Or:
+        depth--;
+        stack[depth - 1] = stack[depth - 1] || stack[depth];
+        break;
+      }
+    }
+
+    return stack[0] != IsExclusion;
+  }
+
+  //Recursive descent parser of constraint expressions, such as IsTransparent || Threshold == 0
+  class ConstraintParser
+  {
+  public:
+    ConstraintParser(const std::string& text, const std::vector<std::unique_ptr<ShaderOption>>& options) :
+      _text(text),
+      _options(options)
+    {
+      static regex tokenRegex("\\s*(\\|\\||&&|==|!=|<=|>=|[()!<>]|\\w+)");
+
+      auto position = text.cbegin();
+      smatch match;
+      while (regex_search(position, text.cend(), match, tokenRegex, regex_constants::match_continuous))
+      {
+        _tokens.push_back(match[1]);
+        position = match[0].second;
+      }
+
+      position = find_if(position, text.cend(), [](char character) { return !isspace(uint8_t(character)); });
+      if (position != text.cend()) Fail("unexpected '" + string(position, text.cend()) + "'");
+    }
+
+    std::vector<ConstraintInstruction> Parse()
+    {
+      if (_tokens.empty()) Fail("the expression is empty");
+
+      ParseOr();
+      if (_position < _tokens.size()) Fail("unexpected '" + _tokens[_position] + "'");
+
+      //Check the stack depth needed to evaluate the program
+      size_t depth = 0, maxDepth = 0;
+      for (auto& instruction : _program)
+      {
+        if (instruction.Operation == ConstraintOperation::And || instruction.Operation == ConstraintOperation::Or) depth--;
+        else if (instruction.Operation != ConstraintOperation::Not) depth++;
+        maxDepth = max(maxDepth, depth);
+      }
+      if (maxDepth > ShaderConstraint::MaxDepth) Fail("the expression is too deeply nested");
+
+      return move(_program);
+    }
+
+  private:
+    const std::string& _text;
+    const std::vector<std::unique_ptr<ShaderOption>>& _options;
+    std::vector<std::string> _tokens;
+    size_t _position = 0;
+    std::vector<ConstraintInstruction> _program;
+
+    [[noreturn]] void Fail(const std::string& reason) const
+    {
+      throw runtime_error("Invalid constraint '" + _text + "': " + reason + ".");
+    }
+
+    bool Accept(const char* token)
+    {
+      if (_position < _tokens.size() && _tokens[_position] == token)
+      {
+        _position++;
+        return true;
+      }
+      return false;
+    }
+
+    const std::string& Next()
+    {
+      if (_position == _tokens.size()) Fail("the expression ends unexpectedly");
+      return _tokens[_position++];
+    }
+
+    void ParseOr()
+    {
+      ParseAnd();
+      while (Accept("||"))
+      {
+        ParseAnd();
+        _program.push_back({ ConstraintOperation::Or });
+      }
+    }
+
+    void ParseAnd()
+    {
+      ParseUnary();
+      while (Accept("&&"))
+      {
+        ParseUnary();
+        _program.push_back({ ConstraintOperation::And });
+      }
+    }
+
+    void ParseUnary()
+    {
+      if (Accept("!"))
+      {
+        ParseUnary();
+        _program.push_back({ ConstraintOperation::Not });
+      }
+      else if (Accept("("))
+      {
+        ParseOr();
+        if (!Accept(")")) Fail("missing ')'");
+      }
+      else
+      {
+        ParseComparison();
+      }
+    }
+
+    void ParseComparison()
+    {
+      auto& name = Next();
+      auto option = find_if(_options.begin(), _options.end(), [&](const unique_ptr<ShaderOption>& item) { return item->Name == name; });
+      if (option == _options.end()) Fail("unknown option '" + name + "'");
+
+      ConstraintInstruction instruction{ ConstraintOperation::Equal, size_t(option - _options.begin()) };
+
+      static const pair<const char*, ConstraintOperation> operations[] = {
+        { "==", ConstraintOperation::Equal },
+        { "!=", ConstraintOperation::NotEqual },
+        { "<", ConstraintOperation::Less },
+        { "<=", ConstraintOperation::LessOrEqual },
+        { ">", ConstraintOperation::Greater },
+        { ">=", ConstraintOperation::GreaterOrEqual }
+      };
+
+      auto hasOperation = false;
+      for (auto& [token, operation] : operations)
+      {
+        if (Accept(token))
+        {
+          instruction.Operation = operation;
+          hasOperation = true;
+          break;
+        }
+      }
+
+      //Boolean options may stand on their own
+      if (!hasOperation)
+      {
+        if ((*option)->Type() != OptionType::Boolean) Fail("option '" + name + "' must be compared to a value");
+
+        instruction.Value = 1;
+        _program.push_back(instruction);
+        return;
+      }
+
+      auto& value = Next();
+      auto isOrdering = instruction.Operation != ConstraintOperation::Equal && instruction.Operation != ConstraintOperation::NotEqual;
+      switch ((*option)->Type())
+      {
+      case OptionType::Boolean:
+        if (isOrdering) Fail("boolean option '" + name + "' can only be compared with == and !=");
+        if (value == "true" || value == "1") instruction.Value = 1;
+        else if (value == "false" || value == "0") instruction.Value = 0;
+        else Fail("boolean option '" + name + "' has no value '" + value + "'");
+        break;
+      case OptionType::Enumeration:
+      {
+        if (isOrdering) Fail("enum option '" + name + "' can only be compared with == and !=");
+
+        auto& values = static_cast<const EnumerationOption*>(option->get())->Values;
+        auto position = find(values.begin(), values.end(), value);
+        if (position == values.end()) Fail("enum option '" + name + "' has no value '" + value + "'");
+        instruction.Value = int64_t(position - values.begin());
+        break;
+      }
+      case OptionType::Integer:
+      {
+        if (value.empty() || !all_of(value.begin(), value.end(), [](char character) { return isdigit(uint8_t(character)); })) Fail("integer option '" + name + "' is compared to '" + value + "'");
+
+        //Values outside the range of the option compare as usual
+        instruction.Value = stoll(value) - static_cast<const IntegerOption*>(option->get())->Minimum;
+        break;
+      }
+      }
+
+      _program.push_back(instruction);
+    }
+  };
+
+  ShaderConstraint ShaderConstraint::Parse(const std::string& text, bool isExclusion, const std::vector<std::unique_ptr<ShaderOption>>& options)
+  {
+    ShaderConstraint result;
+    result.Text = text.substr(0, text.find("//"));
+    result.Text.erase(result.Text.find_last_not_of(" \t\r") + 1);
+    result.IsExclusion = isExclusion;
+    result.Program = ConstraintParser(result.Text, options).Parse();
+    return result;
+  }
+
   OptionType BooleanOption::Type() const
   {
     return OptionType::Boolean;
@@ -10,6 +10,46 @@ namespace ShaderGenerator
     Integer
   };
 
+  struct ShaderOption;
+
+  enum class ConstraintOperation : uint8_t
+  {
+    Equal,
+    NotEqual,
+    Less,
+    LessOrEqual,
+    Greater,
+    GreaterOrEqual,
+    Not,
+    And,
+    Or
+  };
+
+  struct ConstraintInstruction
+  {
+    ConstraintOperation Operation;
+
+    //Option and value index compared, unused by the logical operations
+    size_t Option = 0;
+    int64_t Value = 0;
+  };
+
+  //A boolean rule between option values, #pragma constraint keeps the variants satisfying it, #pragma exclude skips them
+  struct ShaderConstraint
+  {
+    inline static const size_t MaxDepth = 32;
+
+    std::string Text;
+    bool IsExclusion = false;
+
+    //Postfix program evaluated on the value indices of the options
+    std::vector<ConstraintInstruction> Program;
+
+    bool Allows(const std::vector<size_t>& indices) const;
+
+    static ShaderConstraint Parse(const std::string& text, bool isExclusion, const std::vector<std::unique_ptr<ShaderOption>>& options);
+  };
+
   struct OptionPermutation
   {
     std::vector<std::pair<std::string, std::string>> Defines;
@@ -30,7 +70,11 @@ namespace ShaderGenerator
 
     virtual bool TryGetDefinedValue(size_t index, std::string& value) const = 0;
 
-    static std::vector<OptionPermutation> Permutate(const std::vector<std::unique_ptr<ShaderOption>>& options);
+    //Returns every combination of the option values allowed by the constraints
+    static std::vector<OptionPermutation> Permutate(const std::vector<std::unique_ptr<ShaderOption>>& options, const std::vector<ShaderConstraint>& constraints = {});
+
+    //Returns the number of combinations of the option values, including those excluded by constraints
+    static size_t CountPermutations(const std::vector<std::unique_ptr<ShaderOption>>& options);
 
     virtual ~ShaderOption() = default;
   };
@@ -76,10 +120,12 @@ namespace ShaderGenerator
   {
     std::filesystem::path Path;
     std::vector<std::unique_ptr<ShaderOption>> Options;
+    std::vector<ShaderConstraint> Constraints;
     std::string Namespace;
     std::string Target;
     std::string EntryPoint = "main";
     std::vector<std::filesystem::path> Dependencies;
+    std::vector<std::chrono::time_point<std::chrono::system_clock>> DependencyTimestamps;
     std::chrono::time_point<std::chrono::system_clock> InputTimestamp;
 
     static ShaderInfo FromFile(const std::filesystem::path& path);
@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "ShaderGroupBuilder.h"
+#include "ShaderCompiler.h"
+#include "ShaderOutputWriter.h"
+#include "FileAttributes.h"
+#include "Profiler.h"
+
+using namespace std;
+
+namespace ShaderGenerator
+{
+  bool BuildShaderGroup(const ShaderCompilationArguments& arguments, const ShaderInfo& shader, ShaderCache* cache, bool force)
+  {
+    stage_timer timer{ "build" };
+    timer.set_group(shader.Path);
+    timer.set_outer();
+
+    if (!arguments.Header.empty())
+    {
+      auto skip = false;
+      if (!force && filesystem::exists(arguments.Header))
+      {
+        auto headerTime = get_file_time(arguments.Header, file_time_kind::modification);
+        skip = headerTime > shader.InputTimestamp;
+      }
+
+      if (!skip)
+      {
+        stage_timer headerTimer{ "header" };
+        headerTimer.set_group(shader.Path);
+        WriteHeader(arguments, shader);
+      }
+    }
+
+    if (!arguments.Output.empty())
+    {
+      auto skip = false;
+      if (!force && filesystem::exists(arguments.Output))
+      {
+        auto shaderTime = get_file_time(arguments.Output, file_time_kind::modification);
+        skip = shaderTime > shader.InputTimestamp;
+      }
+
+      if (!skip)
+      {
+        ShaderBinaryWriter writer{ arguments.Output, shader, arguments.Compression, arguments.Layout };
+        return CompileShader(shader, arguments, cache, writer);
+      }
+    }
+
+    return true;
+  }
+
+  bool BuildShaderGroup(const ShaderCompilationArguments& arguments, ShaderCache* cache)
+  {
+    auto shader = ShaderInfo::FromFile(arguments.Input);
+    return BuildShaderGroup(arguments, shader, cache);
+  }
+}
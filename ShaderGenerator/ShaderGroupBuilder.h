@@ -0,0 +1,13 @@
+#pragma once
+#include "ShaderConfiguration.h"
+
+namespace ShaderGenerator
+{
+  class ShaderCache;
+
+  //Writes the header and the compiled binary of a shader group, outputs newer than the inputs are skipped unless forced
+  //Returns false if a shader variant failed to compile, the previous binary is kept in that case
+  bool BuildShaderGroup(const ShaderCompilationArguments& arguments, const ShaderInfo& shader, ShaderCache* cache, bool force = false);
+
+  bool BuildShaderGroup(const ShaderCompilationArguments& arguments, ShaderCache* cache);
+}
@@ -0,0 +1,268 @@
+#include "pch.h"
+#include "ShaderLayout.h"
+#include "ShaderConfiguration.h"
+#include "Parallel.h"
+
+using namespace std;
+
+namespace ShaderGenerator
+{
+  ShaderBlockLayout::ShaderBlockLayout(const ShaderInfo& info, size_t shaderVariationCount)
+  {
+    if (shaderVariationCount <= MaxBlockSize)
+    {
+      BlockSize = shaderVariationCount;
+    }
+    else
+    {
+      //Find the first N options that divide the variations into blocks that are smaller than MaxBlockSize
+      for (auto& option : info.Options)
+      {
+        BlockCount *= option->ValueCount();
+        BlockSize = shaderVariationCount / BlockCount;
+        BlockIndexOffset += option->KeyLength();
+        if (BlockSize <= MaxBlockSize)
+        {
+          //Construct the index mask: first BlockIndexOffset number of bits are 1s
+          BlockIndexMask = (1ull << BlockIndexOffset) - 1;
+          break;
+        }
+      }
+    }
+  }
+
+  bool ShaderLayoutSettings::IsAdaptive() const
+  {
+    return BlockSize || !AccessTrace.empty();
+  }
+
+  //Number of min-hashes compared when ordering blobs
+  const size_t SignatureLength = 4;
+
+  typedef array<uint64_t, SignatureLength> blob_signature;
+
+  static uint64_t MixBits(uint64_t value)
+  {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+  }
+
+  //Min-hashes of the 8 byte words at each dword boundary, blobs sharing more of their words are more likely to share hashes
+  static blob_signature CalculateSignature(span<const uint8_t> blob)
+  {
+    blob_signature signature;
+    signature.fill(UINT64_MAX);
+
+    for (size_t position = 0; position + sizeof(uint64_t) <= blob.size(); position += sizeof(uint32_t))
+    {
+      uint64_t word;
+      memcpy(&word, blob.data() + position, sizeof(word));
+
+      auto hash = MixBits(word);
+      for (size_t i = 0; i < SignatureLength; i++)
+      {
+        signature[i] = min(signature[i], MixBits(hash + i));
+      }
+    }
+
+    return signature;
+  }
+
+  std::vector<std::vector<size_t>> CreateAdaptiveBlockLayout(const std::vector<std::span<const uint8_t>>& blobs, size_t blockSize)
+  {
+    //Sorting by the signatures places blobs with common min-hashes next to each other
+    vector<blob_signature> signatures(blobs.size());
+    parallel_for(blobs.size(), [&](size_t index) {
+      signatures[index] = CalculateSignature(blobs[index]);
+    });
+
+    vector<size_t> order(blobs.size());
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return signatures[a] < signatures[b]; });
+
+    //Cut blocks when the next blob would exceed the target size
+    vector<vector<size_t>> results;
+    size_t currentSize = 0;
+    for (auto index : order)
+    {
+      if (results.empty() || (currentSize + blobs[index].size() > blockSize && currentSize > 0))
+      {
+        results.emplace_back();
+        currentSize = 0;
+      }
+
+      results.back().push_back(index);
+      currentSize += blobs[index].size();
+    }
+
+    return results;
+  }
+
+  shader_access_trace ReadShaderAccessTrace(const std::filesystem::path& path)
+  {
+    ifstream stream(path);
+    if (!stream.good()) throw runtime_error("Failed to open access trace " + path.string() + ".");
+
+    shader_access_trace results;
+    string line, frame, key, currentFrame;
+    while (getline(stream, line))
+    {
+      if (line.empty() || line[0] == '#') continue;
+
+      istringstream fields(line);
+      if (!(fields >> frame >> key)) throw runtime_error("Invalid access trace line: " + line);
+
+      if (results.empty() || frame != currentFrame)
+      {
+        results.emplace_back();
+        currentFrame = frame;
+      }
+
+      results.back().push_back(stoull(key, nullptr, 0));
+    }
+
+    return results;
+  }
+
+  //Frames accessing more blobs only pair each of them with its neighbors in access order
+  const size_t CoAccessWindow = 64;
+
+  std::vector<std::vector<size_t>> CreateTracedBlockLayout(const std::vector<std::span<const uint8_t>>& blobs, const std::vector<std::vector<size_t>>& frames, size_t blockSize)
+  {
+    //First access and the number of frames each pair of blobs is used together
+    vector<size_t> firstAccesses(blobs.size(), SIZE_MAX);
+    unordered_map<uint64_t, size_t> pairCounts;
+
+    size_t time = 0;
+    for (auto& frame : frames)
+    {
+      vector<size_t> frameBlobs;
+      unordered_set<size_t> visitedBlobs;
+      for (auto blob : frame)
+      {
+        if (!visitedBlobs.insert(blob).second) continue;
+
+        frameBlobs.push_back(blob);
+        if (firstAccesses[blob] == SIZE_MAX) firstAccesses[blob] = time++;
+      }
+
+      for (size_t i = 0; i < frameBlobs.size(); i++)
+      {
+        for (size_t j = i + 1; j < min(frameBlobs.size(), i + CoAccessWindow); j++)
+        {
+          auto a = min(frameBlobs[i], frameBlobs[j]), b = max(frameBlobs[i], frameBlobs[j]);
+          pairCounts[(uint64_t(a) << 32) | b]++;
+        }
+      }
+    }
+
+    //Merge the clusters of the most frequent pairs first, as long as they fit into a block
+    vector<pair<uint64_t, size_t>> pairs{ pairCounts.begin(), pairCounts.end() };
+    sort(pairs.begin(), pairs.end(), [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    vector<size_t> parents(blobs.size()), clusterSizes(blobs.size());
+    iota(parents.begin(), parents.end(), 0);
+    for (size_t i = 0; i < blobs.size(); i++)
+    {
+      clusterSizes[i] = blobs[i].size();
+    }
+
+    auto findRoot = [&](size_t blob) {
+      while (parents[blob] != blob)
+      {
+        parents[blob] = parents[parents[blob]];
+        blob = parents[blob];
+      }
+      return blob;
+    };
+
+    for (auto& [pair, count] : pairs)
+    {
+      auto a = findRoot(size_t(pair >> 32)), b = findRoot(size_t(pair & UINT32_MAX));
+      if (a == b || clusterSizes[a] + clusterSizes[b] > blockSize) continue;
+
+      //The cluster accessed first keeps its root, so roots always hold the earliest access of their cluster
+      if (firstAccesses[b] < firstAccesses[a]) swap(a, b);
+      parents[b] = a;
+      clusterSizes[a] += clusterSizes[b];
+    }
+
+    //Order the accessed blobs by the first access of their cluster, then by their own
+    vector<size_t> accessedBlobs, remainingBlobs;
+    for (size_t i = 0; i < blobs.size(); i++)
+    {
+      if (firstAccesses[i] != SIZE_MAX) accessedBlobs.push_back(i);
+      else remainingBlobs.push_back(i);
+    }
+
+    sort(accessedBlobs.begin(), accessedBlobs.end(), [&](size_t a, size_t b) {
+      auto rootA = firstAccesses[findRoot(a)], rootB = firstAccesses[findRoot(b)];
+      return rootA != rootB ? rootA < rootB : firstAccesses[a] < firstAccesses[b];
+    });
+
+    //Pack neighboring clusters into blocks without splitting them
+    vector<vector<size_t>> results;
+    size_t currentSize = 0;
+    for (size_t i = 0; i < accessedBlobs.size(); )
+    {
+      auto root = findRoot(accessedBlobs[i]);
+      if (results.empty() || (currentSize + clusterSizes[root] > blockSize && currentSize > 0))
+      {
+        results.emplace_back();
+        currentSize = 0;
+      }
+
+      for (; i < accessedBlobs.size() && findRoot(accessedBlobs[i]) == root; i++)
+      {
+        results.back().push_back(accessedBlobs[i]);
+      }
+      currentSize += clusterSizes[root];
+    }
+
+    //Variants missing from the trace are grouped by their similarity after the traced ones
+    vector<span<const uint8_t>> remainingData;
+    for (auto blob : remainingBlobs)
+    {
+      remainingData.push_back(blobs[blob]);
+    }
+
+    for (auto& block : CreateAdaptiveBlockLayout(remainingData, blockSize))
+    {
+      for (auto& blob : block)
+      {
+        blob = remainingBlobs[blob];
+      }
+      results.push_back(move(block));
+    }
+
+    return results;
+  }
+
+  size_t CountBlockActivations(const std::vector<std::vector<size_t>>& frames, const std::vector<size_t>& blobBlocks)
+  {
+    size_t result = 0, activeBlock = SIZE_MAX;
+    vector<bool> loadedBlobs(blobBlocks.size());
+    for (auto& frame : frames)
+    {
+      for (auto blob : frame)
+      {
+        if (loadedBlobs[blob]) continue;
+        loadedBlobs[blob] = true;
+
+        if (blobBlocks[blob] != activeBlock)
+        {
+          activeBlock = blobBlocks[blob];
+          result++;
+        }
+      }
+    }
+
+    return result;
+  }
+}
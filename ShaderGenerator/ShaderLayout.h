@@ -0,0 +1,48 @@
+#pragma once
+#include "pch.h"
+
+namespace ShaderGenerator
+{
+  struct ShaderInfo;
+
+  struct ShaderLayoutSettings
+  {
+    inline static const size_t DefaultTracedBlockSize = 64ull * 1024ull;
+
+    //Target decompressed block size in bytes, zero splits blocks along the leading options
+    size_t BlockSize = 0;
+
+    //Recorded shader accesses used to place variants used together into the same blocks
+    std::filesystem::path AccessTrace;
+
+    bool IsAdaptive() const;
+  };
+
+  //Splits the variations into blocks along the leading options, so the keys of a block share their low bits
+  struct ShaderBlockLayout
+  {
+    inline static const size_t MaxBlockSize = 64;
+
+    size_t BlockCount = 1ull;
+    size_t BlockSize = 0ull;
+    size_t BlockIndexOffset = 0ull;
+    uint64_t BlockIndexMask = 0ull;
+
+    ShaderBlockLayout(const ShaderInfo& info, size_t shaderVariationCount);
+  };
+
+  //Shader keys accessed by each frame in access order
+  typedef std::vector<std::vector<uint64_t>> shader_access_trace;
+
+  //Reads a trace, each line holds a frame id or timestamp and a key, consecutive lines with the same frame id form a frame
+  shader_access_trace ReadShaderAccessTrace(const std::filesystem::path& path);
+
+  //Orders the blobs so similar bytecode ends up next to each other, then cuts them into blocks of about the specified decompressed size
+  std::vector<std::vector<size_t>> CreateAdaptiveBlockLayout(const std::vector<std::span<const uint8_t>>& blobs, size_t blockSize);
+
+  //Places blobs accessed in the same frames into the same blocks and orders the blocks by first access, frames list blob indices
+  std::vector<std::vector<size_t>> CreateTracedBlockLayout(const std::vector<std::span<const uint8_t>>& blobs, const std::vector<std::vector<size_t>>& frames, size_t blockSize);
+
+  //Replays the frames against a loader keeping a single active block and the shaders already loaded, returns the number of blocks decompressed
+  size_t CountBlockActivations(const std::vector<std::vector<size_t>>& frames, const std::vector<size_t>& blobBlocks);
+}
@@ -2,235 +2,678 @@
 #include "ShaderOutputWriter.h"
 #include "IO.h"
 #include "Parallel.h"
+#include "Hash.h"
+#include "BlockCompression.h"
+#include "ShaderLayout.h"
+#include "Profiler.h"
 
-using namespace winrt;
-using namespace winrt::Windows::Storage;
-using namespace winrt::Windows::Storage::Compression;
-using namespace winrt::Windows::Storage::Streams;
 using namespace std;
 using namespace std::filesystem;
 
 namespace ShaderGenerator
 {
-  struct ShaderBlockLayout
+  struct ShaderBlob
   {
-    inline static const size_t MaxBlockSize = 64;
+    uint32_t Index;
+    const CompiledShader* Shader;
+  };
+
+  template<typename T>
+  static uint8_t* WriteValue(uint8_t* target, const T& value)
+  {
+    static_assert(is_trivially_copyable_v<T>);
+    memcpy(target, &value, sizeof(T));
+    return target + sizeof(T);
+  }
+
+  template<typename T>
+  static void AppendValue(vector<uint8_t>& buffer, const T& value)
+  {
+    buffer.resize(buffer.size() + sizeof(T));
+    WriteValue(buffer.data() + buffer.size() - sizeof(T), value);
+  }
+
+  const char ContainerMagic[4] = { 'C', 'S', 'G', '4' };
+  const char ShaderRecordMagic[4] = { 'S', 'H', '0', '1' };
+  const size_t ShaderRecordHeaderSize = sizeof(ShaderRecordMagic) + sizeof(uint64_t) + sizeof(uint32_t);
+
+  //Blocks are held back until the unique variants collected reach this multiple of the dictionary size
+  const size_t DictionarySampleRatio = 32;
+
+  //The presence bitmap is only written while its key space is at most this many times the number of keys
+  const size_t MaxKeySpaceRatio = 64;
+
+  struct KeyOption
+  {
+    uint32_t BitOffset;
+    uint32_t Radix;
+  };
+
+  //Maps a key to its mixed radix index, the keys of the group map to [0, product of the radices) in the same order
+  static optional<uint64_t> GetDenseKeyIndex(uint64_t key, const vector<KeyOption>& options)
+  {
+    uint64_t result = 0, stride = 1, usedBits = 0;
+    for (auto& option : options)
+    {
+      auto bitCount = option.Radix > 1 ? bit_width(option.Radix - 1u) : 0;
+      auto mask = (uint64_t(1) << bitCount) - 1;
+
+      auto digit = (key >> option.BitOffset) & mask;
+      if (digit >= option.Radix) return nullopt;
+
+      usedBits |= mask << option.BitOffset;
+      result += digit * stride;
+      stride *= option.Radix;
+    }
+
+    if (key & ~usedBits) return nullopt;
+    return result;
+  }
+
+  struct CompressionBlock
+  {
+    uint32_t FirstBlob;
+    uint32_t BlobCount;
+    BlockCodec Codec;
+    uint32_t UncompressedLength;
+    vector<uint8_t> Data;
+
+    //Start of each frame in the compressed data or of each record in the uncompressed data, followed by the end of the last one
+    vector<uint32_t> FrameOffsets;
+  };
+
+  CompressionBlock CreateShaderBlock(const vector<ShaderBlob>& blobs, const BlockCompressionSettings& compression, const FrameCompressor* frameCompressor)
+  {
+    CompressionBlock block;
+    block.FirstBlob = blobs.begin()->Index;
+    block.BlobCount = uint32_t(blobs.size());
+    block.Codec = compression.ContainerCodec();
+
+    //Frames hold the bytecode alone, the index locates them
+    if (frameCompressor)
+    {
+      size_t uncompressedLength = 0;
+      for (auto& blob : blobs)
+      {
+        block.FrameOffsets.push_back(uint32_t(block.Data.size()));
+        frameCompressor->Compress(blob.Shader->Data, block.Data);
+        uncompressedLength += blob.Shader->Data.size();
+      }
+
+      if (block.Data.size() > UINT32_MAX || uncompressedLength > UINT32_MAX) throw runtime_error("Shader block is too large.");
+      block.FrameOffsets.push_back(uint32_t(block.Data.size()));
+      block.UncompressedLength = uint32_t(uncompressedLength);
+      return block;
+    }
 
-    size_t BlockCount = 1ull;
-    size_t BlockSize = 0ull;
-    size_t BlockIndexOffset = 0ull;
-    uint64_t BlockIndexMask = 0ull;
+    //Records are serialized into a buffer reused by every block processed on this thread, stored blocks are serialized into their data directly
+    thread_local vector<uint8_t> scratch;
+    auto isStored = compression.Codec == BlockCodec::Stored;
+    auto& records = isStored ? block.Data : scratch;
 
-    ShaderBlockLayout(const ShaderInfo& info, size_t shaderVariationCount)
+    size_t recordsSize = 0;
+    for (auto& blob : blobs)
     {
-      if (shaderVariationCount <= MaxBlockSize)
+      recordsSize += ShaderRecordHeaderSize + blob.Shader->Data.size();
+    }
+    if (recordsSize > UINT32_MAX) throw runtime_error("Shader block is too large.");
+    records.resize(recordsSize);
+    block.UncompressedLength = uint32_t(recordsSize);
+
+    auto position = records.data();
+    for (auto& blob : blobs)
+    {
+      block.FrameOffsets.push_back(uint32_t(position - records.data()));
+      position = WriteValue(position, ShaderRecordMagic);
+      position = WriteValue(position, uint64_t(blob.Index));
+      position = WriteValue(position, uint32_t(blob.Shader->Data.size()));
+
+      memcpy(position, blob.Shader->Data.data(), blob.Shader->Data.size());
+      position += blob.Shader->Data.size();
+    }
+    block.FrameOffsets.push_back(uint32_t(recordsSize));
+
+    if (!isStored) CompressBlock(compression, records, block.Data);
+
+    return block;
+  }
+
+  ShaderBinaryWriter::ShaderBinaryWriter(const std::filesystem::path& path, const ShaderInfo& shader, const BlockCompressionSettings& compression, const ShaderLayoutSettings& layout) :
+    _path(path),
+    _temporaryPath(path.string() + ".tmp"),
+    _pdbDirectory(path.parent_path() / "ShaderPdb"),
+    _shader(&shader),
+    _compression(compression),
+    _codec(compression.ContainerCodec()),
+    _layout(layout)
+  { }
+
+  ShaderBinaryWriter::~ShaderBinaryWriter()
+  {
+    if (_file) Abort();
+  }
+
+  void ShaderBinaryWriter::Begin(const std::vector<OptionPermutation>& permutations, const std::vector<size_t>& representatives)
+  {
+    printf("Writing output shaders to %s...\n", _path.string().c_str());
+
+    //Ensure output directory
+    error_code ec;
+    filesystem::create_directory(_path.parent_path(), ec);
+    if (ec) throw runtime_error("Failed to create output directory " + _path.parent_path().string() + ".");
+
+    //Define block layout, adaptive layouts are created once every variant is available
+    if (_layout.IsAdaptive())
+    {
+      if (!_layout.AccessTrace.empty())
       {
-        BlockSize = shaderVariationCount;
+        _accessTrace = ReadShaderAccessTrace(_layout.AccessTrace);
+        printf("Layout: blocks of variants accessed together in %zu frame(s) of %s.\n", _accessTrace.size(), _layout.AccessTrace.string().c_str());
       }
       else
       {
-        //Find the first N options that divide the variations into blocks that are smaller than MaxBlockSize
-        for (auto& option : info.Options)
-        {
-          BlockCount *= option->ValueCount();
-          BlockSize = shaderVariationCount / BlockCount;
-          BlockIndexOffset += option->KeyLength();
-          if (BlockSize <= MaxBlockSize)
-          {
-            //Construct the index mask: first BlockIndexOffset number of bits are 1s
-            BlockIndexMask = (1ull << BlockIndexOffset) - 1;
-            break;
-          }
-        }
+        printf("Layout: adaptive blocks of about %.1f KB.\n", _layout.BlockSize / 1024.0);
       }
+
+      _blockSize = max<size_t>(permutations.size(), 1);
+    }
+    else
+    {
+      ShaderBlockLayout blockLayout{ *_shader, permutations.size() };
+      printf("Layout: %zu block(s), %zu shader variants in each block.\n", blockLayout.BlockCount, blockLayout.BlockSize);
+      _blockSize = max<size_t>(blockLayout.BlockSize, 1);
     }
-  };
 
-  struct CompressionBlock
+    _representatives = representatives;
+    _keys.resize(permutations.size());
+    for (size_t index = 0; index < permutations.size(); index++)
+    {
+      _keys[index] = permutations[index].Key;
+    }
+
+    //Each block waits for its own unique variants, duplicates are stored in the block of their representative
+    _remainingCounts.assign((permutations.size() + _blockSize - 1) / _blockSize, 0);
+    for (size_t index = 0; index < permutations.size(); index++)
+    {
+      if (representatives[index] == index) _remainingCounts[index / _blockSize]++;
+    }
+
+    _pendingShaders.resize(permutations.size());
+    _shaderBlobs.resize(permutations.size());
+    _shaderSizes.resize(permutations.size());
+
+    //The file is written under a temporary name, so a failed compilation leaves the previous output intact
+    _file = make_unique<OutputFile>(_temporaryPath);
+
+    //Header, the index offset is filled in when the index is written after the blocks
+    vector<uint8_t> header;
+    header.insert(header.end(), ContainerMagic, ContainerMagic + sizeof(ContainerMagic));
+    AppendValue(header, uint64_t(0));
+    _file->Write({ header });
+  }
+
+  void ShaderBinaryWriter::Add(size_t index, CompiledShader&& shader)
   {
-    uint64_t Key;
-    vector<uint64_t> Components;
-    Buffer Data{ nullptr };
-  };
+    auto blockIndex = index / _blockSize;
+    {
+      lock_guard<mutex> lock(_mutex);
+      _shaderSizes[index] = shader.Data.size();
+      _pendingShaders[index] = move(shader);
+      if (--_remainingCounts[blockIndex] > 0 || _layout.IsAdaptive()) return;
+    }
+
+    WriteBlock(blockIndex);
+  }
 
-  CompressionBlock CreateShaderBlock(const array_view<const CompiledShader>& shaders, const ShaderBlockLayout& layout)
+  void ShaderBinaryWriter::WriteBlock(size_t blockIndex)
   {
-    CompressionBlock block;
-    block.Key = shaders.begin()->Key & layout.BlockIndexMask;
-    block.Components.reserve(shaders.size());
+    //Collect the variants stored in the block, nobody else touches them from now on
+    PendingBlock block;
+    for (auto index = blockIndex * _blockSize; index < min((blockIndex + 1) * _blockSize, _keys.size()); index++)
+    {
+      if (_representatives[index] == index) block.Members.push_back(index);
+    }
 
-    InMemoryRandomAccessStream compressedStream;
-    Compressor compressor{ compressedStream, CompressAlgorithm::Lzms, 64 * 1024 * 1024 };
+    vector<content_hash> hashes;
+    hashes.reserve(block.Members.size());
+    for (auto index : block.Members)
+    {
+      hashes.push_back(content_hasher::hash(_pendingShaders[index].Data.data(), _pendingShaders[index].Data.size()));
+    }
 
-    //Add shaders
-    for (auto& shader : shaders)
+    //Variants compiling to identical bytecode share a single blob, which is stored in the first block written
+    vector<PendingBlock> blocks;
     {
-      //Serialize shader
-      InMemoryRandomAccessStream uncompressedStream;
+      lock_guard<mutex> lock(_mutex);
+      block.FirstBlob = _blobCount;
+
+      size_t blockSize = 0;
+      for (size_t i = 0; i < block.Members.size(); i++)
       {
-        DataWriter dataWriter{ uncompressedStream };
-        dataWriter.ByteOrder(ByteOrder::LittleEndian);
-        dataWriter.WriteString(L"SH01");
-        dataWriter.WriteUInt64(shader.Key);
-        dataWriter.WriteUInt32(uint32_t(shader.Data.size()));
-        dataWriter.WriteBytes(shader.Data);
-        dataWriter.StoreAsync().get();
-        dataWriter.FlushAsync().get();
-        dataWriter.DetachStream();
+        auto& shader = _pendingShaders[block.Members[i]];
+        auto [blobIndex, isNew] = _blobIndices.emplace(hashes[i], _blobCount);
+        if (isNew)
+        {
+          block.BlobShaders.push_back(block.Members[i]);
+          _blobCount++;
+          blockSize += shader.Data.size();
+        }
+
+        _shaderBlobs[block.Members[i]] = blobIndex->second;
       }
+      _uniqueSize += blockSize;
 
-      //Copy data into a buffer
-      auto contentSize = uint32_t(uncompressedStream.Size());
+      //With dictionaries, blocks wait until enough variants are collected to train one
+      if (_compression.DictionarySize && !_frameCompressor)
+      {
+        _deferredBlocks.push_back(move(block));
+        _deferredSize += blockSize;
+        if (_isTrainingDictionary || _deferredSize < _compression.DictionarySize * DictionarySampleRatio) return;
+
+        _isTrainingDictionary = true;
+        blocks = move(_deferredBlocks);
+        _deferredBlocks.clear();
+      }
+    }
 
-      Buffer buffer{ contentSize };
-      uncompressedStream.Seek(0);
-      uncompressedStream.ReadAsync(buffer, contentSize, InputStreamOptions::None).get();
+    if (blocks.empty())
+    {
+      AppendBlock(block);
+      return;
+    }
 
-      //Write compressed data
-      compressor.WriteAsync(buffer).get();
-      block.Components.push_back(shader.Key);
+    //Blocks completed during training are written by this thread as well
+    auto frameCompressor = CreateFrameCompressor(blocks);
+    {
+      lock_guard<mutex> lock(_mutex);
+      _frameCompressor = move(frameCompressor);
+      move(_deferredBlocks.begin(), _deferredBlocks.end(), back_inserter(blocks));
+      _deferredBlocks.clear();
     }
 
-    //Finish compression
-    compressor.FlushAsync().get();
-    compressor.FinishAsync().get();
-    compressor.DetachStream();
+    for (auto& deferredBlock : blocks)
+    {
+      AppendBlock(deferredBlock);
+    }
+  }
 
-    //Save results
-    auto blockSize = uint32_t(compressedStream.Size());
-    block.Data = Buffer{ blockSize };
+  void ShaderBinaryWriter::AppendBlock(PendingBlock& block)
+  {
+    //Compress and append the block
+    if (!block.BlobShaders.empty())
+    {
+      vector<ShaderBlob> blobs;
+      blobs.reserve(block.BlobShaders.size());
+      for (auto index : block.BlobShaders)
+      {
+        blobs.push_back({ uint32_t(block.FirstBlob + blobs.size()), &_pendingShaders[index] });
+      }
 
-    compressedStream.Seek(0);
-    compressedStream.ReadAsync(block.Data, blockSize, InputStreamOptions::None).get();
+      CompressionBlock compressedBlock;
+      {
+        stage_timer timer{ "compress" };
+        timer.set_group(_path);
+        compressedBlock = CreateShaderBlock(blobs, _compression, _frameCompressor.get());
+        timer.set_bytes(compressedBlock.UncompressedLength);
+      }
 
-    return block;
+      vector<ShaderFrame> frames;
+      for (size_t i = 0; i + 1 < compressedBlock.FrameOffsets.size(); i++)
+      {
+        auto offset = compressedBlock.FrameOffsets[i];
+        frames.push_back({ offset, compressedBlock.FrameOffsets[i + 1] - offset, uint32_t(blobs[i].Shader->Data.size()) });
+      }
+
+      lock_guard<mutex> lock(_fileMutex);
+      stage_timer timer{ "write", compressedBlock.Data.size() };
+      timer.set_group(_path);
+      _blocks.push_back({ _file->Size(), compressedBlock.Data.size(), compressedBlock.FirstBlob, compressedBlock.BlobCount, compressedBlock.Codec, compressedBlock.UncompressedLength, move(frames) });
+      _file->Write({ compressedBlock.Data });
+    }
+
+    //Release the variants
+    for (auto index : block.Members)
+    {
+      WriteDebugDatabase(_pendingShaders[index]);
+      _pendingShaders[index] = {};
+    }
   }
 
-  void WriteShaderBinary(std::filesystem::path path, const std::vector<CompiledShader>& compiledShaders, const ShaderInfo& shaderInfo)
+  std::unique_ptr<FrameCompressor> ShaderBinaryWriter::CreateFrameCompressor(const std::vector<PendingBlock>& blocks) const
   {
-    try
+    stage_timer timer{ "dictionary" };
+    timer.set_group(_path);
+
+    vector<span<const uint8_t>> samples;
+    for (auto& block : blocks)
     {
-      wprintf(L"Writing output shaders to %s...\n", path.c_str());
+      for (auto index : block.BlobShaders)
+      {
+        samples.push_back(_pendingShaders[index].Data);
+      }
+    }
 
-      //Ensure output directory
-      auto root = path.parent_path();
+    auto result = make_unique<FrameCompressor>(_compression, samples);
+    printf("Dictionary: %.1f KB built from %zu shader variants.\n", result->Dictionary().size() / 1024.0, samples.size());
+    return result;
+  }
 
-      error_code ec;
-      filesystem::create_directory(root, ec);
-      if (ec) throw runtime_error("Failed to create output directory.");
+  void ShaderBinaryWriter::WriteAdaptiveBlocks()
+  {
+    vector<size_t> members;
+    for (size_t index = 0; index < _keys.size(); index++)
+    {
+      if (_representatives[index] == index) members.push_back(index);
+    }
 
-      //Define block layout
-      ShaderBlockLayout blockLayout{ shaderInfo, compiledShaders.size() };
-      wprintf(L"Layout: %zu block(s), %zu shader variants in each block.\n", blockLayout.BlockCount, blockLayout.BlockSize);
+    vector<content_hash> hashes(members.size());
+    parallel_for(members.size(), [&](size_t i) {
+      hashes[i] = content_hasher::hash(_pendingShaders[members[i]].Data.data(), _pendingShaders[members[i]].Data.size());
+    });
 
-      //Organize compiled shaders into blocks
-      vector<array_view<const CompiledShader>> input;
-      input.reserve(blockLayout.BlockCount);
-      for (size_t i = 0; i < compiledShaders.size(); )
+    //Variants compiling to identical bytecode share a single blob
+    vector<size_t> blobShaders, memberBlobs(members.size());
+    unordered_map<content_hash, size_t> blobPositions;
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      auto [position, isNew] = blobPositions.emplace(hashes[i], blobShaders.size());
+      if (isNew)
       {
-        array_view<const CompiledShader> block(&compiledShaders[i], uint32_t(blockLayout.BlockSize));
-        input.push_back(block);
-        i += block.size();
+        blobShaders.push_back(members[i]);
+        _uniqueSize += _pendingShaders[members[i]].Data.size();
       }
 
-      //Run compression threads
-      auto output = parallel_map<array_view<const CompiledShader>, CompressionBlock>(input,
-        [&](const auto& shaderBlock)
-        {
-          return CreateShaderBlock(shaderBlock, blockLayout);
-        }
-      );
-
-      //Write output data
-      path.make_preferred();
-      auto storageFolder = StorageFolder::GetFolderFromPathAsync(path.parent_path().c_str()).get();
-      auto storageFile = storageFolder.CreateFileAsync(path.filename().c_str(), CreationCollisionOption::ReplaceExisting).get();
-      auto fileStream = storageFile.OpenAsync(FileAccessMode::ReadWrite).get();
-
-      DataWriter dataWriter{ fileStream };
-      dataWriter.ByteOrder(ByteOrder::LittleEndian);
-      dataWriter.WriteString(L"CSG3");
-      dataWriter.WriteUInt64(blockLayout.BlockIndexMask);
-      dataWriter.WriteUInt32(uint32_t(output.size()));
-
-      size_t compressedOffset = 0;
-      for (auto& block : output)
+      memberBlobs[i] = position->second;
+    }
+
+    //Group similar blobs into blocks, blob indices follow the block order
+    vector<span<const uint8_t>> blobs;
+    blobs.reserve(blobShaders.size());
+    for (auto index : blobShaders)
+    {
+      blobs.push_back(_pendingShaders[index].Data);
+    }
+
+    auto blockSize = _layout.BlockSize ? _layout.BlockSize : ShaderLayoutSettings::DefaultTracedBlockSize;
+
+    vector<vector<size_t>> layout;
+    vector<vector<size_t>> tracedFrames;
+    if (_accessTrace.empty())
+    {
+      layout = CreateAdaptiveBlockLayout(blobs, blockSize);
+    }
+    else
+    {
+      //Translate the keys of the trace to blobs, unknown keys are skipped
+      unordered_map<uint64_t, size_t> keyBlobs;
+      for (size_t i = 0; i < members.size(); i++)
       {
-        dataWriter.WriteUInt64(block.Key);
-        dataWriter.WriteUInt64(compressedOffset);
-        dataWriter.WriteUInt32(uint32_t(block.Components.size()));
-        compressedOffset += block.Data.Length();
+        keyBlobs[_keys[members[i]]] = memberBlobs[i];
       }
 
-      for (auto& block : output)
+      for (size_t index = 0; index < _keys.size(); index++)
       {
-        dataWriter.WriteBuffer(block.Data);
+        if (_representatives[index] != index) keyBlobs[_keys[index]] = keyBlobs.at(_keys[_representatives[index]]);
       }
 
-      dataWriter.StoreAsync().get();
-      dataWriter.FlushAsync().get();
-      dataWriter.DetachStream();
-
-      //Close file
-      fileStream.FlushAsync().get();
-      fileStream.Close();
+      size_t unknownCount = 0;
+      for (auto& frame : _accessTrace)
+      {
+        auto& frameBlobs = tracedFrames.emplace_back();
+        for (auto key : frame)
+        {
+          auto blob = keyBlobs.find(key);
+          if (blob != keyBlobs.end()) frameBlobs.push_back(blob->second);
+          else unknownCount++;
+        }
+      }
 
-      wprintf(L"Output saved to %s.\n", path.c_str());
+      if (unknownCount) printf("Access trace: %zu access(es) to unknown shader keys skipped.\n", unknownCount);
+      layout = CreateTracedBlockLayout(blobs, tracedFrames, blockSize);
     }
-    catch (const hresult_error& error)
+
+    vector<PendingBlock> blocks(layout.size());
+    vector<uint32_t> blobIndices(blobShaders.size());
+    vector<size_t> blobBlocks(blobShaders.size());
+    size_t largestBlockSize = 0;
+    for (size_t blockIndex = 0; blockIndex < layout.size(); blockIndex++)
     {
-      wprintf(L"Failed to save output to %s. Reason: %s\n", path.c_str(), error.message().c_str());
+      auto& block = blocks[blockIndex];
+      block.FirstBlob = _blobCount;
+
+      size_t blockSize = 0;
+      for (auto position : layout[blockIndex])
+      {
+        blobIndices[position] = _blobCount++;
+        blobBlocks[position] = blockIndex;
+        block.BlobShaders.push_back(blobShaders[position]);
+        blockSize += blobs[position].size();
+      }
+      largestBlockSize = max(largestBlockSize, blockSize);
     }
-    catch (const exception& error)
+
+    for (size_t i = 0; i < members.size(); i++)
     {
-      printf("Failed to save output to %s. Reason: %s\n", path.string().c_str(), error.what());
+      _shaderBlobs[members[i]] = blobIndices[memberBlobs[i]];
+      blocks[blobBlocks[memberBlobs[i]]].Members.push_back(members[i]);
     }
-    catch (...)
+
+    printf("Layout: %zu block(s), %.1f KB on average, %.1f KB at most.\n",
+      blocks.size(),
+      blocks.empty() ? 0.0 : _uniqueSize / 1024.0 / blocks.size(),
+      largestBlockSize / 1024.0);
+
+    //Compare with the option based layout, where each blob is stored in the block of its first variant
+    if (!tracedFrames.empty())
     {
-      wprintf(L"Failed to save output to %s. An unknown error has been encountered.\n", path.c_str());
+      ShaderBlockLayout defaultLayout{ *_shader, _keys.size() };
+      vector<size_t> defaultBlobBlocks(blobShaders.size());
+      for (size_t position = 0; position < blobShaders.size(); position++)
+      {
+        defaultBlobBlocks[position] = blobShaders[position] / max<size_t>(defaultLayout.BlockSize, 1);
+      }
+
+      size_t accessCount = 0;
+      for (auto& frame : tracedFrames)
+      {
+        accessCount += frame.size();
+      }
+
+      printf("Access trace: %zu access(es), %zu block activation(s) expected with the traced layout, %zu with the default layout.\n",
+        accessCount,
+        CountBlockActivations(tracedFrames, blobBlocks),
+        CountBlockActivations(tracedFrames, defaultBlobBlocks));
     }
+
+    if (_compression.DictionarySize && !blocks.empty()) _frameCompressor = CreateFrameCompressor(blocks);
+    parallel_for(blocks.size(), [&](size_t index) { AppendBlock(blocks[index]); });
   }
 
-  void WriteDebugDatabase(const std::filesystem::path& path, const std::vector<CompiledShader>& compiledShaders)
+  void ShaderBinaryWriter::Finish()
   {
-    //Check if PDB data is available
-    auto hasPdb = any_of(compiledShaders.begin(), compiledShaders.end(), [](const CompiledShader& shader) { return !shader.PdbName.empty() && !shader.PdbData.empty(); });
-    if (!hasPdb) return;
+    if (_layout.IsAdaptive()) WriteAdaptiveBlocks();
 
-    //Ensure output directory
-    auto root = path.parent_path() / "ShaderPdb";
+    //Groups smaller than the dictionary sample size are compressed at the end
+    if (!_deferredBlocks.empty())
+    {
+      _frameCompressor = CreateFrameCompressor(_deferredBlocks);
+      parallel_for(_deferredBlocks.size(), [&](size_t index) { AppendBlock(_deferredBlocks[index]); });
+      _deferredBlocks.clear();
+    }
 
-    error_code ec;
-    filesystem::create_directory(root, ec);
+    //Blocks are appended in the order they are completed, the index lists them in blob order
+    sort(_blocks.begin(), _blocks.end(), [](const WrittenBlock& a, const WrittenBlock& b) { return a.FirstBlob < b.FirstBlob; });
 
-    if (ec)
+    vector<pair<uint64_t, uint32_t>> aliases;
+    aliases.reserve(_keys.size());
+
+    size_t totalSize = 0;
+    for (size_t index = 0; index < _keys.size(); index++)
     {
-      wprintf(L"Failed to create PDB directory at %s.\n", root.c_str());
-      return;
+      auto representative = _representatives[index];
+      aliases.push_back({ _keys[index], _shaderBlobs[representative] });
+      totalSize += _shaderSizes[representative];
     }
+    sort(aliases.begin(), aliases.end());
 
-    //Write PDB files
-    wprintf(L"Writing PDBs to %s...\n", root.c_str());
+    printf("Deduplication: %zu shader variants stored as %zu unique blobs (%.2fx), %.1f KB saved.\n",
+      _keys.size(),
+      size_t(_blobCount),
+      _blobCount ? double(_keys.size()) / _blobCount : 1.0,
+      (totalSize - _uniqueSize) / 1024.0);
 
-    for (auto& shader : compiledShaders)
+    uint64_t compressedSize = 0, uncompressedSize = 0;
+    for (auto& block : _blocks)
     {
-      if (shader.PdbName.empty() || shader.PdbData.empty()) continue;
+      compressedSize += block.Length;
+      uncompressedSize += block.UncompressedLength;
+    }
 
-      if (WriteAllBytes(root / shader.PdbName, shader.PdbData))
+    printf("Compression: %.1f KB stored as %.1f KB with %s (%.2fx).\n",
+      uncompressedSize / 1024.0,
+      compressedSize / 1024.0,
+      GetBlockCodecName(_codec),
+      compressedSize ? double(uncompressedSize) / compressedSize : 1.0);
+
+    //Index
+    stage_timer timer{ "index" };
+    timer.set_group(_path);
+    vector<uint8_t> index;
+    AppendValue(index, uint32_t(_blocks.size()));
+    AppendValue(index, _blobCount);
+    AppendValue(index, uint32_t(aliases.size()));
+
+    //Every blob is listed with its frame or record, so the loader does not scan the blocks
+    AppendValue(index, _blobCount);
+
+    vector<uint8_t> noDictionary;
+    auto& dictionary = _frameCompressor ? _frameCompressor->Dictionary() : noDictionary;
+    AppendValue(index, uint32_t(dictionary.size()));
+    index.insert(index.end(), dictionary.begin(), dictionary.end());
+
+    //Key layout and presence bitmap, the loader turns a key into its alias index with them instead of searching
+    {
+      vector<KeyOption> keyOptions;
+      uint32_t bitOffset = 0;
+      uint64_t keySpaceSize = 1;
+      for (auto& option : _shader->Options)
       {
-        wprintf(L"PDB saved to %s.\n", path.c_str());
+        keyOptions.push_back({ bitOffset, uint32_t(option->ValueCount()) });
+        bitOffset += uint32_t(option->KeyLength());
+        keySpaceSize *= option->ValueCount();
       }
-      else
+
+      //Sparse key spaces are left to the binary search of the aliases
+      vector<uint64_t> presenceWords;
+      if (bitOffset <= 32 && keySpaceSize <= MaxKeySpaceRatio * max<size_t>(aliases.size(), 1))
+      {
+        presenceWords.resize((keySpaceSize + 63) / 64);
+        for (auto& [key, blobIndex] : aliases)
+        {
+          auto denseIndex = GetDenseKeyIndex(key, keyOptions);
+          if (!denseIndex)
+          {
+            presenceWords.clear();
+            break;
+          }
+
+          presenceWords[*denseIndex / 64] |= uint64_t(1) << (*denseIndex % 64);
+        }
+      }
+
+      if (presenceWords.empty()) keyOptions.clear();
+
+      AppendValue(index, uint32_t(keyOptions.size()));
+      for (auto& option : keyOptions)
+      {
+        AppendValue(index, option);
+      }
+
+      //The words are followed by the number of keys before each of them
+      AppendValue(index, uint32_t(presenceWords.size()));
+      for (auto word : presenceWords)
+      {
+        AppendValue(index, word);
+      }
+
+      uint32_t rank = 0;
+      for (auto word : presenceWords)
+      {
+        AppendValue(index, rank);
+        rank += uint32_t(popcount(word));
+      }
+    }
+
+    for (auto& block : _blocks)
+    {
+      AppendValue(index, block.Offset);
+      AppendValue(index, block.Length);
+      AppendValue(index, block.FirstBlob);
+      AppendValue(index, block.BlobCount);
+      AppendValue(index, block.Codec);
+      AppendValue(index, block.UncompressedLength);
+    }
+
+    //Frames and records are listed in blob order, their offsets are relative to their block
+    for (auto& block : _blocks)
+    {
+      for (auto& frame : block.Frames)
       {
-        wprintf(L"Failed to save PDB to %s.\n", path.c_str());
+        AppendValue(index, frame);
       }
     }
+
+    for (auto& [key, blobIndex] : aliases)
+    {
+      AppendValue(index, key);
+      AppendValue(index, blobIndex);
+    }
+
+    auto indexOffset = _file->Size();
+    _file->Write({ index });
+    _file->WriteAt(sizeof(ContainerMagic), span(reinterpret_cast<const uint8_t*>(&indexOffset), sizeof(indexOffset)));
+    _file->Close();
+    _file.reset();
+
+    //Replace the previous output
+    error_code ec;
+    filesystem::rename(_temporaryPath, _path, ec);
+    if (ec) throw runtime_error("Failed to save output to " + _path.string() + ".");
+
+    printf("Output saved to %s.\n", _path.string().c_str());
   }
 
-  void WriteShaderOutput(const std::filesystem::path& path, const std::vector<CompiledShader>& compiledShaders, const ShaderInfo& shader)
+  void ShaderBinaryWriter::Abort()
   {
-    WriteShaderBinary(path, compiledShaders, shader);
-    WriteDebugDatabase(path, compiledShaders);
+    _file.reset();
+
+    error_code ec;
+    filesystem::remove(_temporaryPath, ec);
+  }
+
+  void ShaderBinaryWriter::WriteDebugDatabase(const CompiledShader& shader)
+  {
+    if (shader.PdbName.empty() || shader.PdbData.empty()) return;
+
+    //Ensure output directory
+    error_code ec;
+    filesystem::create_directory(_pdbDirectory, ec);
+
+    if (ec)
+    {
+      printf("Failed to create PDB directory at %s.\n", _pdbDirectory.string().c_str());
+      return;
+    }
+
+    auto path = _pdbDirectory / shader.PdbName;
+    if (WriteAllBytes(path, shader.PdbData))
+    {
+      printf("PDB saved to %s.\n", path.string().c_str());
+    }
+    else
+    {
+      printf("Failed to save PDB to %s.\n", path.string().c_str());
+    }
   }
 
   void WriteHeader(const ShaderCompilationArguments& arguments, const ShaderInfo& shader)
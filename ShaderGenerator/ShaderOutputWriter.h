@@ -1,9 +1,88 @@
 #pragma once
 #include "ShaderCompiler.h"
+#include "BlockCompression.h"
+#include "ShaderLayout.h"
+#include "Hash.h"
+#include "IO.h"
 
 namespace ShaderGenerator
 {
-  void WriteShaderOutput(const std::filesystem::path& path, const std::vector<CompiledShader>& data, const ShaderInfo& shader);
+  //Writes the variants of a shader group into a container while they are being compiled, each block is compressed and appended as soon as all of its variants are available
+  class ShaderBinaryWriter : public CompiledShaderSink
+  {
+  public:
+    ShaderBinaryWriter(const std::filesystem::path& path, const ShaderInfo& shader, const BlockCompressionSettings& compression = {}, const ShaderLayoutSettings& layout = {});
+    ~ShaderBinaryWriter();
+
+    virtual void Begin(const std::vector<OptionPermutation>& permutations, const std::vector<size_t>& representatives) override;
+
+    virtual void Add(size_t index, CompiledShader&& shader) override;
+
+    virtual void Finish() override;
+
+    virtual void Abort() override;
+
+  private:
+    struct ShaderFrame
+    {
+      uint32_t Offset;
+      uint32_t Length;
+      uint32_t Size;
+    };
+
+    struct PendingBlock
+    {
+      std::vector<size_t> Members;
+      std::vector<size_t> BlobShaders;
+      uint32_t FirstBlob;
+    };
+
+    struct WrittenBlock
+    {
+      uint64_t Offset;
+      uint64_t Length;
+      uint32_t FirstBlob;
+      uint32_t BlobCount;
+      BlockCodec Codec;
+      uint32_t UncompressedLength;
+      std::vector<ShaderFrame> Frames;
+    };
+
+    std::filesystem::path _path, _temporaryPath, _pdbDirectory;
+    const ShaderInfo* _shader;
+    BlockCompressionSettings _compression;
+    BlockCodec _codec;
+    ShaderLayoutSettings _layout;
+    shader_access_trace _accessTrace;
+    size_t _blockSize = 0;
+
+    std::vector<uint64_t> _keys;
+    std::vector<size_t> _representatives;
+
+    std::mutex _mutex;
+    std::vector<size_t> _remainingCounts;
+    std::vector<CompiledShader> _pendingShaders;
+    std::vector<uint32_t> _shaderBlobs;
+    std::vector<size_t> _shaderSizes;
+    std::unordered_map<content_hash, uint32_t> _blobIndices;
+    uint32_t _blobCount = 0;
+    size_t _uniqueSize = 0;
+
+    std::unique_ptr<FrameCompressor> _frameCompressor;
+    std::vector<PendingBlock> _deferredBlocks;
+    size_t _deferredSize = 0;
+    bool _isTrainingDictionary = false;
+
+    std::mutex _fileMutex;
+    std::unique_ptr<OutputFile> _file;
+    std::vector<WrittenBlock> _blocks;
+
+    void WriteBlock(size_t blockIndex);
+    void AppendBlock(PendingBlock& block);
+    void WriteAdaptiveBlocks();
+    std::unique_ptr<FrameCompressor> CreateFrameCompressor(const std::vector<PendingBlock>& blocks) const;
+    void WriteDebugDatabase(const CompiledShader& shader);
+  };
 
   void WriteHeader(const ShaderCompilationArguments& path, const ShaderInfo& shader);
-}
\ No newline at end of file
+}
@@ -0,0 +1,417 @@
+#include "pch.h"
+#include "ShaderWatcher.h"
+#include "ShaderGroupBuilder.h"
+#include "ShaderCache.h"
+#include "SourceFileCache.h"
+#include "FileAttributes.h"
+#include "Parallel.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  ShaderWatcher::ShaderWatcher(std::vector<ShaderCompilationArguments>&& groups, ShaderCache* cache, const std::string& pipeName) :
+    _cache(cache),
+    _pipeName(pipeName)
+  {
+    _groups.reserve(groups.size());
+    for (auto& arguments : groups)
+    {
+      WatchedGroup group{};
+      group.Arguments = move(arguments);
+      group.Dependencies = { group.Arguments.Input };
+      _groups.push_back(move(group));
+    }
+  }
+
+  ShaderWatcher::~ShaderWatcher()
+  {
+    StopPipeServer();
+  }
+
+  void ShaderWatcher::Run()
+  {
+    //Bring outputs up to date
+    CheckForChanges();
+    BuildDirtyGroups(false);
+
+    _pipeServer = thread(&ShaderWatcher::RunPipeServer, this);
+    printf("Watching %zu shader group(s) for changes, commands are accepted at %s.\n", _groups.size(), GetPipePath().c_str());
+
+    while (true)
+    {
+      shared_ptr<Command> command;
+      {
+        unique_lock<mutex> lock(_commandMutex);
+        _commandCondition.wait_for(lock, PollInterval, [&] { return !_commands.empty(); });
+        if (!_commands.empty())
+        {
+          command = _commands.front();
+          _commands.pop();
+        }
+      }
+
+      if (command)
+      {
+        auto isExiting = false;
+        command->Response.set_value(ExecuteCommand(command->Text, isExiting));
+        if (isExiting) break;
+      }
+      else if (CheckForChanges())
+      {
+        BuildDirtyGroups(true);
+      }
+    }
+
+    StopPipeServer();
+  }
+
+  bool ShaderWatcher::CheckForChanges()
+  {
+    //Query each file once, even if multiple groups depend on it
+    unordered_map<path, chrono::time_point<chrono::system_clock>> currentTimestamps;
+    auto getTimestamp = [&](const path& file) {
+      auto [timestamp, isNew] = currentTimestamps.emplace(file, chrono::time_point<chrono::system_clock>{});
+      if (isNew) timestamp->second = get_file_time(file, file_time_kind::modification);
+      return timestamp->second;
+    };
+
+    auto hasChanges = false;
+    for (auto& group : _groups)
+    {
+      for (auto& dependency : group.Dependencies)
+      {
+        auto timestamp = _timestamps.find(dependency);
+        if (timestamp == _timestamps.end() || timestamp->second != getTimestamp(dependency))
+        {
+          group.IsDirty = true;
+        }
+      }
+
+      hasChanges |= group.IsDirty;
+    }
+
+    //Drop the stored contents of changed files
+    for (auto& [file, timestamp] : currentTimestamps)
+    {
+      auto& storedTimestamp = _timestamps[file];
+      if (storedTimestamp != timestamp)
+      {
+        SourceFileCache::Shared().Invalidate(file);
+        storedTimestamp = timestamp;
+      }
+    }
+
+    return hasChanges;
+  }
+
+  bool ShaderWatcher::BuildDirtyGroups(bool force)
+  {
+    vector<WatchedGroup*> dirtyGroups;
+    for (auto& group : _groups)
+    {
+      if (group.IsDirty) dirtyGroups.push_back(&group);
+    }
+
+    if (dirtyGroups.empty()) return true;
+
+    atomic<bool> isSucceeded = true;
+    parallel_for(dirtyGroups.size(), [&](size_t index) {
+      auto& group = *dirtyGroups[index];
+      group.IsDirty = false;
+
+      try
+      {
+        //Parse the group again, as its options or includes might have changed
+        group.Shader = ShaderInfo::FromFile(group.Arguments.Input);
+        group.Dependencies = group.Shader->Dependencies;
+
+        if (!BuildShaderGroup(group.Arguments, *group.Shader, _cache, force)) isSucceeded = false;
+      }
+      catch (const std::exception& error)
+      {
+        printf("Shader group %s compilation failed: %s\n", group.Arguments.Input.string().c_str(), error.what());
+        isSucceeded = false;
+      }
+    });
+
+    //Start tracking newly included files from the time they were scanned, so changes made during the build trigger another one
+    for (auto group : dirtyGroups)
+    {
+      if (!group->Shader) continue;
+
+      auto& shader = *group->Shader;
+      for (size_t index = 0; index < shader.Dependencies.size(); index++)
+      {
+        _timestamps.try_emplace(shader.Dependencies[index], shader.DependencyTimestamps[index]);
+      }
+    }
+
+    //Enforce the size limit after every build, as the watcher may run for a long time and is usually killed rather than quit
+    if (_cache)
+    {
+      _cache->Trim();
+      _cache->PrintStatistics();
+    }
+
+    return isSucceeded;
+  }
+
+  std::string ShaderWatcher::ExecuteCommand(const std::string& text, bool& isExiting)
+  {
+    static regex commandRegex("\\s*(\\w+)\\s*(.*?)\\s*");
+
+    smatch match;
+    if (!regex_match(text, match, commandRegex))
+    {
+      return "unknown command";
+    }
+
+    if (match[1] == "build")
+    {
+      //Build changed groups without waiting for the next poll
+      CheckForChanges();
+      return BuildDirtyGroups(true) ? "ok" : "failed";
+    }
+    else if (match[1] == "rebuild")
+    {
+      //Rebuild all groups, or the ones with the specified input path
+      auto groupPath = path(match[2].str()).lexically_normal();
+
+      auto isFound = false;
+      for (auto& group : _groups)
+      {
+        if (groupPath.empty() || group.Arguments.Input.lexically_normal() == groupPath || group.Arguments.Input.filename() == groupPath)
+        {
+          group.IsDirty = true;
+          isFound = true;
+        }
+      }
+
+      if (!isFound) return "unknown shader group";
+      return BuildDirtyGroups(true) ? "ok" : "failed";
+    }
+    else if (match[1] == "quit")
+    {
+      isExiting = true;
+      return "ok";
+    }
+    else
+    {
+      return "unknown command";
+    }
+  }
+
+  std::future<std::string> ShaderWatcher::PostCommand(const std::string& text)
+  {
+    auto command = make_shared<Command>();
+    command->Text = text;
+    auto response = command->Response.get_future();
+
+    {
+      lock_guard<mutex> lock(_commandMutex);
+      if (_isStopping)
+      {
+        command->Response.set_value("exiting");
+        return response;
+      }
+
+      _commands.push(move(command));
+    }
+    _commandCondition.notify_one();
+
+    return response;
+  }
+
+  void ShaderWatcher::FailPendingCommands()
+  {
+    //Commands queued after the last one executed would never get a response, so their clients are answered here
+    lock_guard<mutex> lock(_commandMutex);
+    while (!_commands.empty())
+    {
+      _commands.front()->Response.set_value("exiting");
+      _commands.pop();
+    }
+  }
+
+  std::string ShaderWatcher::PostCommandLines(std::string& buffer)
+  {
+    //Execute complete lines and keep the rest for later
+    string responses;
+    size_t lineEnd;
+    while ((lineEnd = buffer.find('\n')) != string::npos)
+    {
+      auto line = buffer.substr(0, lineEnd);
+      buffer.erase(0, lineEnd + 1);
+
+      responses += PostCommand(line).get() + "\n";
+    }
+
+    return responses;
+  }
+
+#ifdef _WIN32
+  std::string ShaderWatcher::GetPipePath() const
+  {
+    return "\\\\.\\pipe\\" + _pipeName;
+  }
+
+  void ShaderWatcher::RunPipeServer()
+  {
+    auto pipePath = winrt::to_hstring(GetPipePath());
+    winrt::handle ioEvent{ CreateEvent(nullptr, true, false, nullptr) };
+
+    //Waits for an overlapped operation, connecting and reading are abandoned once the watcher stops, writing completes so responses are delivered
+    auto waitFor = [&](HANDLE pipe, OVERLAPPED& overlapped, DWORD& length, bool isStoppable) {
+      if (isStoppable)
+      {
+        HANDLE events[] = { overlapped.hEvent, _stopEvent.get() };
+        if (WaitForMultipleObjects(2, events, false, INFINITE) != WAIT_OBJECT_0)
+        {
+          CancelIo(pipe);
+          GetOverlappedResult(pipe, &overlapped, &length, true);
+          return false;
+        }
+      }
+
+      return GetOverlappedResult(pipe, &overlapped, &length, true) != FALSE;
+    };
+
+    while (!_isStopping)
+    {
+      winrt::file_handle pipe{ CreateNamedPipe(pipePath.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 4096, 4096, 0, nullptr) };
+      if (!pipe)
+      {
+        printf("Failed to create pipe %s, commands will not be accepted.\n", GetPipePath().c_str());
+        return;
+      }
+
+      OVERLAPPED overlapped{};
+      overlapped.hEvent = ioEvent.get();
+
+      DWORD length = 0;
+      auto isConnected = ConnectNamedPipe(pipe.get(), &overlapped) || GetLastError() == ERROR_PIPE_CONNECTED || (GetLastError() == ERROR_IO_PENDING && waitFor(pipe.get(), overlapped, length, true));
+      if (!isConnected) continue;
+
+      //Execute commands line by line until the client disconnects
+      string buffer;
+      char chunk[256];
+      while (true)
+      {
+        DWORD readLength = 0;
+        if (!ReadFile(pipe.get(), chunk, sizeof(chunk), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING) break;
+        if (!waitFor(pipe.get(), overlapped, readLength, true) || readLength == 0) break;
+
+        buffer.append(chunk, readLength);
+
+        auto responses = PostCommandLines(buffer);
+        DWORD writtenLength = 0;
+        if (!WriteFile(pipe.get(), responses.data(), DWORD(responses.size()), nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING) break;
+        if (!waitFor(pipe.get(), overlapped, writtenLength, false)) break;
+      }
+
+      DisconnectNamedPipe(pipe.get());
+    }
+  }
+
+  void ShaderWatcher::StopPipeServer()
+  {
+    {
+      lock_guard<mutex> lock(_commandMutex);
+      _isStopping = true;
+      SetEvent(_stopEvent.get());
+    }
+
+    //The server might wait for a queued command, so those are answered before joining it, no more are queued once stopping
+    FailPendingCommands();
+    if (_pipeServer.joinable()) _pipeServer.join();
+  }
+#else
+  std::string ShaderWatcher::GetPipePath() const
+  {
+    return (temp_directory_path() / (_pipeName + ".sock")).string();
+  }
+
+  void ShaderWatcher::RunPipeServer()
+  {
+    auto socketPath = GetPipePath();
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path))
+    {
+      printf("Socket path %s is too long, commands will not be accepted.\n", socketPath.c_str());
+      return;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    auto server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());
+    if (server < 0 || bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(server, 1) != 0)
+    {
+      printf("Failed to create socket %s, commands will not be accepted.\n", socketPath.c_str());
+      if (server >= 0) close(server);
+      return;
+    }
+
+    {
+      lock_guard<mutex> lock(_commandMutex);
+      _serverSocket = server;
+      if (_isStopping) shutdown(server, SHUT_RDWR);
+    }
+
+    while (!_isStopping)
+    {
+      auto client = accept(server, nullptr, nullptr);
+      if (client < 0) continue;
+
+      {
+        lock_guard<mutex> lock(_commandMutex);
+        _clientSocket = client;
+        if (_isStopping) shutdown(client, SHUT_RD);
+      }
+
+      //Execute commands line by line until the client disconnects
+      string buffer;
+      char chunk[256];
+      ssize_t readLength;
+      while ((readLength = read(client, chunk, sizeof(chunk))) > 0)
+      {
+        buffer.append(chunk, size_t(readLength));
+
+        auto responses = PostCommandLines(buffer);
+        if (!responses.empty() && write(client, responses.data(), responses.size()) < 0) break;
+      }
+
+      {
+        lock_guard<mutex> lock(_commandMutex);
+        _clientSocket = -1;
+      }
+      close(client);
+    }
+
+    {
+      lock_guard<mutex> lock(_commandMutex);
+      _serverSocket = -1;
+    }
+    close(server);
+    unlink(socketPath.c_str());
+  }
+
+  void ShaderWatcher::StopPipeServer()
+  {
+    //Shutting down the sockets wakes the server from accepting and reading, the responses being written are still delivered
+    {
+      lock_guard<mutex> lock(_commandMutex);
+      _isStopping = true;
+      if (_serverSocket >= 0) shutdown(_serverSocket, SHUT_RDWR);
+      if (_clientSocket >= 0) shutdown(_clientSocket, SHUT_RD);
+    }
+
+    //The server might wait for a queued command, so those are answered before joining it, no more are queued once stopping
+    FailPendingCommands();
+    if (_pipeServer.joinable()) _pipeServer.join();
+  }
+#endif
+}
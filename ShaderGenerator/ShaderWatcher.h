@@ -0,0 +1,67 @@
+#pragma once
+#include "ShaderConfiguration.h"
+
+namespace ShaderGenerator
+{
+  class ShaderCache;
+
+  //Keeps shader groups up to date by recompiling them when their sources change, also accepts commands over a named pipe, or a local socket outside Windows
+  class ShaderWatcher
+  {
+  public:
+    inline static const std::chrono::milliseconds PollInterval{ 250 };
+
+    ShaderWatcher(std::vector<ShaderCompilationArguments>&& groups, ShaderCache* cache, const std::string& pipeName);
+    ~ShaderWatcher();
+
+    //Runs until a quit command is received, the pipe server is stopped before it returns
+    void Run();
+
+  private:
+    struct WatchedGroup
+    {
+      ShaderCompilationArguments Arguments;
+      std::optional<ShaderInfo> Shader;
+      std::vector<std::filesystem::path> Dependencies;
+      bool IsDirty = true;
+    };
+
+    struct Command
+    {
+      std::string Text;
+      std::promise<std::string> Response;
+    };
+
+    std::vector<WatchedGroup> _groups;
+    ShaderCache* _cache;
+    std::string _pipeName;
+    std::unordered_map<std::filesystem::path, std::chrono::time_point<std::chrono::system_clock>> _timestamps;
+
+    std::mutex _commandMutex;
+    std::condition_variable _commandCondition;
+    std::queue<std::shared_ptr<Command>> _commands;
+
+    //Commands posted once stopping are refused, the blocking calls of the pipe server are interrupted so it can be joined
+    std::thread _pipeServer;
+    std::atomic<bool> _isStopping = false;
+#ifdef _WIN32
+    winrt::handle _stopEvent{ CreateEvent(nullptr, true, false, nullptr) };
+#else
+    //Sockets the server is blocked on, requires the command lock
+    int _serverSocket = -1;
+    int _clientSocket = -1;
+#endif
+
+    bool CheckForChanges();
+    bool BuildDirtyGroups(bool force);
+    std::string ExecuteCommand(const std::string& text, bool& isExiting);
+
+    std::future<std::string> PostCommand(const std::string& text);
+    void FailPendingCommands();
+    std::string PostCommandLines(std::string& buffer);
+
+    std::string GetPipePath() const;
+    void RunPipeServer();
+    void StopPipeServer();
+  };
+}
@@ -0,0 +1,41 @@
+#include "pch.h"
+#include "SourceFileCache.h"
+
+using namespace std;
+using namespace std::filesystem;
+
+namespace ShaderGenerator
+{
+  std::shared_ptr<const std::string> SourceFileCache::Read(const std::filesystem::path& path)
+  {
+    auto normalizedPath = path.lexically_normal();
+
+    {
+      lock_guard<mutex> lock(_mutex);
+      auto file = _files.find(normalizedPath);
+      if (file != _files.end()) return file->second;
+    }
+
+    ifstream stream(normalizedPath, ios::in | ios::binary);
+    if (!stream.good()) return nullptr;
+
+    auto content = make_shared<string>(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+    if (stream.bad()) return nullptr;
+
+    //Another thread might have read the file in the meantime, everyone should use the same instance
+    lock_guard<mutex> lock(_mutex);
+    return _files.emplace(normalizedPath, move(content)).first->second;
+  }
+
+  void SourceFileCache::Invalidate(const std::filesystem::path& path)
+  {
+    lock_guard<mutex> lock(_mutex);
+    _files.erase(path.lexically_normal());
+  }
+
+  SourceFileCache& SourceFileCache::Shared()
+  {
+    static SourceFileCache cache;
+    return cache;
+  }
+}
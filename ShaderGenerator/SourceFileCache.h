@@ -0,0 +1,22 @@
+#pragma once
+#include "pch.h"
+
+namespace ShaderGenerator
+{
+  //Keeps the contents of source files in memory, so they are read once instead of once per shader variant
+  class SourceFileCache
+  {
+  public:
+    //Returns the contents of the file, or nullptr if it cannot be read
+    std::shared_ptr<const std::string> Read(const std::filesystem::path& path);
+
+    //Drops the stored contents of a file, so it is read again on next access
+    void Invalidate(const std::filesystem::path& path);
+
+    static SourceFileCache& Shared();
+
+  private:
+    std::mutex _mutex;
+    std::unordered_map<std::filesystem::path, std::shared_ptr<const std::string>> _files;
+  };
+}
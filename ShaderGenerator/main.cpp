@@ -1,12 +1,15 @@
 ﻿#include "pch.h"
 #include "ShaderCompilationArguments.h"
 #include "ShaderConfiguration.h"
-#include "ShaderCompiler.h"
-#include "ShaderOutputWriter.h"
-#include "FileAttributes.h"
+#include "ShaderCache.h"
+#include "ShaderGroupBuilder.h"
+#include "ShaderWatcher.h"
+#include "Parallel.h"
+#include "Benchmark.h"
+#include "Profiler.h"
 
 using namespace std;
-using namespace winrt;
+using namespace std::filesystem;
 using namespace ShaderGenerator;
 
 int main(int argc, char* argv[])
@@ -19,6 +22,7 @@ int main(int argc, char* argv[])
 
     printf("Usage:\n");
     printf("  -i=<file_path>: Path of the source code\n");
+    printf("  -m=<file_path>: Path of a manifest listing the arguments of one shader group per line\n");
     printf("  -o=<dir_path>: Path of the output directory\n");
     printf("  -h=<dir_path>: Path of the include header\n");
     printf("  -n=<namespace>: Header namespace name\n");
@@ -26,6 +30,19 @@ int main(int argc, char* argv[])
     printf("  -d: Emit debug symbols\n");
     printf("  -x: Strip debug symbols to separate files\n");
     printf("  -t: Test mode - waits for debugger\n");
+    printf("  -c=<dir_path>: Path of the compilation cache - default is <temp dir>/ShaderGeneratorCache\n");
+    printf("  -cl=<size>: Compilation cache size limit in megabytes - default is 1024\n");
+    printf("  -nc: Disable the compilation cache\n");
+    printf("  -j=<count>: Number of worker threads - default is the number of hardware threads\n");
+    printf("  -b=<compiler>: Shader compiler - d3d (default), fake[:<latency_ms>[:<size>[:<distribution>]]] for synthetic bytecode with uniform (default) or lognormal sizes, or the path of a dxc compatible executable\n");
+    printf("  -w[=<pipe_name>]: Watch mode - keeps running and recompiles groups when their sources change, accepts build, rebuild and quit commands at \\\\.\\pipe\\<pipe_name> on Windows, or at the local socket <temp dir>/<pipe_name>.sock elsewhere\n");
+    printf("  -z=<codec>[:<level>]: Block compression - lzms (default on Windows), lz4, zstd or stored\n");
+    printf("  -bs=<size_kb>: Target decompressed block size - groups similar shader variants into blocks of about this size instead of splitting along the leading options\n");
+    printf("  -a=<file_path>: Access trace of <frame> <key> lines - places shader variants used in the same frames into the same blocks\n");
+    printf("  -zd[=<size_kb>]: Compress each shader variant as its own frame against a dictionary trained per group - default size is 64 KB, requires lz4 or zstd\n");
+    printf("  -bench[=<layout>]: Benchmark mode - builds a synthetic group with options of the listed value counts, such as 6x2,4 (default is 8x3), and reports each stage\n");
+    printf("  -r=<file_path>: JSON report of the benchmark mode\n");
+    printf("  --trace=<file_path>: Chrome trace of every stage and shader variant, followed by a summary of the slowest variants\n");
     printf("\n");
 
     printf("Source file usage:\n");
@@ -35,14 +52,19 @@ int main(int argc, char* argv[])
     printf("  #pragma option bool IsSomethingEnabled //A boolean option\n");
     printf("  #pragma option enum RenderMode {X, Y, Z} //An enum option\n");
     printf("  #pragma option uint SampleCount {1..4} //An integer option\n");
+    printf("  #pragma exclude !IsSomethingEnabled && SampleCount > 1 //Variants matching the expression are not compiled\n");
+    printf("  #pragma constraint RenderMode != Z || IsSomethingEnabled //Only variants matching the expression are compiled\n");
     return 0;
   }
 
   try
   {
-    init_apartment();
+#ifdef _WIN32
+    winrt::init_apartment();
+#endif
 
     auto arguments = ShaderCompilationArguments::Parse(argc, argv);
+#ifdef _WIN32
     if (arguments.WaitForDebugger)
     {
       while (!IsDebuggerPresent())
@@ -52,41 +74,98 @@ int main(int argc, char* argv[])
 
       DebugBreak();
     }
+#endif
 
-    auto shader = ShaderInfo::FromFile(arguments.Input);
+    if (arguments.ThreadCount) thread_pool::set_shared_thread_count(arguments.ThreadCount);
 
-    if (!arguments.Header.empty())
+    if (!arguments.Benchmark.empty())
     {
-      auto skip = false;
-      if (filesystem::exists(arguments.Header))
-      {
-        auto headerTime = get_file_time(arguments.Header, file_time_kind::modification);
-        skip = headerTime > shader.InputTimestamp;
-      }
+      RunBenchmark(arguments);
+      return 0;
+    }
 
-      if (!skip) WriteHeader(arguments, shader);
+    //Tracing covers every group built until the generator exits
+    unique_ptr<stage_profiler> profiler;
+    if (!arguments.Trace.empty())
+    {
+      profiler = make_unique<stage_profiler>(true);
+      stage_profiler::install(profiler.get());
     }
 
-    if (!arguments.Output.empty())
+    auto finishTrace = [&] {
+      if (!profiler) return;
+
+      stage_profiler::install(nullptr);
+      profiler->write_trace(arguments.Trace);
+      profiler->print_summary();
+    };
+
+    //Collect shader groups, a manifest lists the arguments of many groups
+    vector<ShaderCompilationArguments> groups;
+    if (arguments.Manifest.empty())
     {
-      auto skip = false;
-      if (filesystem::exists(arguments.Output))
-      {
-        auto shaderTime = get_file_time(arguments.Output, file_time_kind::modification);
-        skip = shaderTime > shader.InputTimestamp;
-      }
+      groups.push_back(arguments);
+    }
+    else
+    {
+      groups = ShaderCompilationArguments::ParseManifest(arguments.Manifest, arguments);
+      printf("Building %zu shader groups from %s...\n", groups.size(), arguments.Manifest.string().c_str());
+    }
 
-      if (!skip)
-      {
-        auto output = CompileShader(shader, arguments);
+    //All groups share the same cache configured on the command line, in watch mode compiled variants are also kept in memory
+    unique_ptr<ShaderCache> cache;
+    path cacheDirectory;
+    if (arguments.IsCacheEnabled) cacheDirectory = arguments.CacheDirectory;
+
+    auto memoryLimit = arguments.IsWatching ? ShaderCache::DefaultMemoryLimit : 0ull;
+    if (!cacheDirectory.empty() || memoryLimit)
+    {
+      cache = make_unique<ShaderCache>(cacheDirectory, arguments.CacheSizeLimit, memoryLimit);
+    }
 
-        if (!output.empty())
+    if (arguments.IsWatching)
+    {
+      ShaderWatcher(move(groups), cache.get(), arguments.PipeName).Run();
+      finishTrace();
+      return 0;
+    }
+
+    auto result = 0;
+    if (groups.size() == 1)
+    {
+      if (!BuildShaderGroup(groups.front(), cache.get())) result = -1;
+    }
+    else
+    {
+      //Build groups concurrently, the variants of all groups are scheduled on the same thread pool
+      atomic<size_t> failedCount = 0;
+      parallel_for(groups.size(), [&](size_t index) {
+        try
+        {
+          if (!BuildShaderGroup(groups[index], cache.get())) failedCount++;
+        }
+        catch (const std::exception& error)
         {
-          WriteShaderOutput(arguments.Output, output, shader);
+          printf("Shader group %s compilation failed: %s\n", groups[index].Input.string().c_str(), error.what());
+          failedCount++;
         }
+      });
+
+      if (failedCount > 0)
+      {
+        printf("%zu of %zu shader groups failed.\n", size_t(failedCount), groups.size());
+        result = -1;
       }
     }
-    return 0;
+
+    if (cache)
+    {
+      cache->Trim();
+      cache->PrintStatistics();
+    }
+
+    finishTrace();
+    return result;
   }
   catch (const std::exception& error)
   {
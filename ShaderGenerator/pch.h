@@ -8,7 +8,22 @@
 #include <sstream>
 #include <unordered_set>
 #include <functional>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <optional>
+#include <future>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <span>
+#include <condition_variable>
+#include <numeric>
+#include <bit>
+#include <cmath>
 
+#ifdef _WIN32
 #define NOMINMAX
 
 #include <Windows.h>
@@ -20,3 +35,37 @@
 
 #include <d3dcompiler.h>
 #pragma comment (lib, "D3DCompiler.lib")
+
+#include <compressapi.h>
+#pragma comment (lib, "Cabinet.lib")
+
+#include <Psapi.h>
+#pragma comment (lib, "Psapi.lib")
+#else
+#include <fcntl.h>
+#include <climits>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//Optional compression libraries
+#if __has_include(<lz4.h>) && __has_include(<lz4hc.h>)
+#define SHADERGENERATOR_HAS_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#ifdef _MSC_VER
+#pragma comment (lib, "lz4.lib")
+#endif
+#endif
+
+#if __has_include(<zstd.h>) && __has_include(<zdict.h>)
+#define SHADERGENERATOR_HAS_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#ifdef _MSC_VER
+#pragma comment (lib, "zstd.lib")
+#endif
+#endif
@@ -0,0 +1,33 @@
+#!/bin/sh
+#Compiles Constraints.hlsl with the fake compiler and checks the variants pruned by its constraints, then checks that a constraint on an unknown option is rejected
+#Usage: CheckConstraints.sh <path_of_ShaderGenerator>
+set -e
+
+generator="$1"
+directory="$(dirname "$0")"
+output="$(mktemp -d)"
+trap 'rm -rf "$output"' EXIT
+
+#Of the 24 combinations, the exclusions remove 9 and 3 and the constraints 1 and 2
+log="$("$generator" -i="$directory/Constraints.hlsl" -o="$output" -b=fake -nc)"
+echo "$log"
+
+if ! echo "$log" | grep -q "Generating 9 shader variants, 15 excluded by constraints."; then
+  echo "Expected 9 shader variants with 15 excluded by constraints." >&2
+  exit 1
+fi
+
+#Constraints may only refer to the options of the group
+printf '#pragma target cs_5_0\n#pragma option bool Shadows\n#pragma exclude Shadows && Missing\n\n[numthreads(1, 1, 1)]\nvoid main()\n{\n}\n' > "$output/UnknownOption.hlsl"
+
+if log="$("$generator" -i="$output/UnknownOption.hlsl" -o="$output" -b=fake -nc)"; then
+  echo "$log"
+  echo "Expected the constraint on an unknown option to fail." >&2
+  exit 1
+fi
+echo "$log"
+
+if ! echo "$log" | grep -q "Invalid constraint 'Shadows && Missing': unknown option 'Missing'."; then
+  echo "Expected an unknown option error." >&2
+  exit 1
+fi
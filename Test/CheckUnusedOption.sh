@@ -0,0 +1,22 @@
+#!/bin/sh
+#Compiles UnusedOption.hlsl with the fake compiler and checks that the variants of its unused Quality option are compiled once
+#Usage: CheckUnusedOption.sh <path_of_ShaderGenerator>
+set -e
+
+generator="$1"
+directory="$(dirname "$0")"
+output="$(mktemp -d)"
+trap 'rm -rf "$output"' EXIT
+
+log="$("$generator" -i="$directory/UnusedOption.hlsl" -o="$output" -b=fake -nc)"
+echo "$log"
+
+if ! echo "$log" | grep -q "Generating 6 shader variants"; then
+  echo "Expected 6 shader variants." >&2
+  exit 1
+fi
+
+if ! echo "$log" | grep -q "Compiling 2 unique variants"; then
+  echo "Expected the variants differing only in the unused option to be compiled once." >&2
+  exit 1
+fi
@@ -0,0 +1,20 @@
+#pragma target cs_5_0
+#pragma option bool Shadows
+#pragma option enum Mode {Forward, Deferred, Debug}
+#pragma option uint Samples {1..4}
+#pragma exclude !Shadows && Samples > 1
+#pragma constraint Mode != Debug || Shadows
+#pragma exclude Mode == Deferred && Samples <= 2
+#pragma constraint (Samples < 4) || Mode == Forward
+
+RWStructuredBuffer<uint> Output : register(u0);
+
+[numthreads(1, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+#ifdef Shadows
+  Output[DTid.x] = Samples;
+#else
+  Output[DTid.x] = 0;
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma target cs_5_0
+#pragma option bool Lighting
+#pragma option enum Quality {Low, Medium, High}
+
+RWStructuredBuffer<float> Output : register(u0);
+
+[numthreads(1, 1, 1)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+#ifdef Lighting
+  Output[DTid.x] = 1.0;
+#else
+  Output[DTid.x] = 0.0;
+#endif
+}
@@ -2,12 +2,45 @@
 #include <vector>
 #include <unordered_map>
 #include <filesystem>
-#include <sstream>
-#include <fstream>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <future>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <span>
+#include <algorithm>
+#include <optional>
+#include <cstring>
+#include <list>
+#include <array>
+#include <bit>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32
 #include <winrt/base.h>
 #include <compressapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//LZ4 is decoded by the library when found, otherwise by the built-in decoder, which can also be selected by defining SHADERGENERATOR_BUILTIN_LZ4
+#if __has_include(<lz4.h>) && !defined(SHADERGENERATOR_BUILTIN_LZ4)
+#define SHADERGENERATOR_HAS_LZ4
+#include <lz4.h>
+#endif
+
+#if __has_include(<zstd.h>)
+#define SHADERGENERATOR_HAS_ZSTD
+#include <zstd.h>
+#endif
 
 namespace ShaderGenerator
 {
@@ -15,26 +48,207 @@ namespace ShaderGenerator
   {
     uint64_t Key = 0ull;
     uint32_t Size = 0u;
-    std::vector<uint8_t> ByteCode;
+
+    //Points into the buffer kept alive by the storage, shaders loaded from the same block share its decompressed buffer
+    std::span<const uint8_t> ByteCode;
+    std::shared_ptr<const void> Storage;
+
+    //Creates a shader owning its bytecode
+    static CompiledShader FromByteCode(uint64_t key, std::vector<uint8_t>&& byteCode)
+    {
+      auto storage = std::make_shared<const std::vector<uint8_t>>(std::move(byteCode));
+
+      CompiledShader result;
+      result.Key = key;
+      result.Size = uint32_t(storage->size());
+      result.ByteCode = *storage;
+      result.Storage = std::move(storage);
+      return result;
+    }
+  };
+
+  //Thrown when a shader is stored with a codec this build of the loader cannot decode, unlike other load failures it is not reported as a missing shader
+  class CompiledShaderCodecError : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+
+  struct CompiledShaderCacheLimits
+  {
+    //Number of decompressed blocks kept, loading shaders from the same block again avoids decompressing it
+    size_t BlockCount = 4;
+
+    //Upper bound of the bytes held by cached blocks and shaders, the least recently used ones are evicted first, zero means unlimited
+    //Each decompressed block is held once, so a budget of the decompressed size of the group keeps every shader cached
+    size_t ByteBudget = 0;
   };
 
   class CompiledShaderGroup
   {
 #pragma region Helper types
+    enum class BlockCodec : uint32_t
+    {
+      Stored = 0,
+      Lzms = 1,
+      Lz4 = 2,
+      Zstd = 3,
+      Lz4Frames = 4,
+      ZstdFrames = 5
+    };
+
     struct ShaderBlockInfo
     {
       uint64_t CompressedOffset = 0ull;
       uint64_t CompressedLength = 0ull;
+      uint32_t FirstBlob = 0u;
       uint32_t ShaderCount = 0u;
+      BlockCodec Codec = BlockCodec::Lzms;
+      uint32_t UncompressedLength = 0u;
+    };
+
+    struct ShaderFrameInfo
+    {
+      uint32_t Offset = 0u;
+      uint32_t Length = 0u;
+      uint32_t Size = 0u;
     };
 
     struct ShaderBlock
     {
-      uint64_t Key;
-      std::unordered_map<uint64_t, uint64_t> ShaderOffsets;
-      std::stringstream Block;
+      //Legacy blocks list their record keys in ascending order and the offsets of the records, the other blocks are located by the record table of the index
+      std::vector<uint64_t> RecordKeys;
+      std::vector<uint32_t> RecordOffsets;
+      std::vector<uint8_t> Data;
+
+      size_t FindRecord(uint64_t recordKey) const
+      {
+        auto record = std::lower_bound(RecordKeys.begin(), RecordKeys.end(), recordKey);
+        if (record == RecordKeys.end() || *record != recordKey) throw std::out_of_range("Shader record not found.");
+        return RecordOffsets[size_t(record - RecordKeys.begin())];
+      }
+    };
+
+    struct CachedBlock
+    {
+      //Becomes ready once the block is decompressed, other threads asking for the block meanwhile wait for it
+      std::shared_future<std::shared_ptr<const ShaderBlock>> Block;
+      uint64_t LoadId = 0ull;
+      uint64_t LastUse = 0ull;
+
+      //Decompressed block counted in the resident size, null until it is loaded
+      const void* Buffer = nullptr;
+      std::list<uint64_t>::iterator Position;
+    };
+
+    //Buffer kept alive by the cached blocks and the cached shaders pointing into it, counted once however many share it
+    struct ResidentBuffer
+    {
+      size_t Size = 0;
+      size_t ReferenceCount = 0;
+    };
+
+    struct CachedShader
+    {
+      std::shared_ptr<const CompiledShader> Shader;
+      uint64_t LastUse = 0ull;
+
+      //Set by lookups holding only the shared lock, eviction gives referenced shaders a second chance
+      std::atomic<bool> IsReferenced = false;
+    };
+
+    //Cached shaders are stored by slot in pages allocated on first use, so only the parts of the key space in use take memory
+    static const size_t ShaderPageSize = 256;
+
+    struct ShaderPage
+    {
+      std::array<CachedShader, ShaderPageSize> Shaders;
+    };
+
+    //Option of the key layout, its digit is stored at the bit offset and weighs stride in the dense index
+    struct KeyOption
+    {
+      uint32_t BitOffset = 0u;
+      uint64_t Mask = 0ull;
+      uint64_t Radix = 0ull;
+      uint64_t Stride = 0ull;
+    };
+
+    //Read-only view of a whole file, the pages are shared with every other process mapping the same file
+    class mapped_file
+    {
+    public:
+      mapped_file() = default;
+
+      explicit mapped_file(const std::filesystem::path& path)
+      {
+#ifdef _WIN32
+        winrt::file_handle file{ CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr) };
+        if (!file) winrt::throw_last_error();
+
+        LARGE_INTEGER size;
+        winrt::check_bool(GetFileSizeEx(file.get(), &size));
+        if (size.QuadPart == 0) throw std::runtime_error("Shader group file is empty.");
+
+        //The view keeps the mapping alive after its handle is closed
+        winrt::handle mapping{ CreateFileMappingW(file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr) };
+        if (!mapping) winrt::throw_last_error();
+
+        _data = static_cast<const uint8_t*>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0));
+        if (!_data) winrt::throw_last_error();
+        _size = size_t(size.QuadPart);
+#else
+        auto file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) throw std::runtime_error("Failed to open shader group file.");
+
+        struct stat status;
+        auto data = fstat(file, &status) == 0 && status.st_size > 0 ? mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+        close(file);
+        if (data == MAP_FAILED) throw std::runtime_error("Failed to map shader group file.");
+
+        _data = static_cast<const uint8_t*>(data);
+        _size = size_t(status.st_size);
+#endif
+      }
+
+      mapped_file(mapped_file&& other) noexcept
+      {
+        *this = std::move(other);
+      }
+
+      mapped_file& operator=(mapped_file&& other) noexcept
+      {
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+        return *this;
+      }
+
+      ~mapped_file()
+      {
+        if (!_data) return;
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+#else
+        munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+      }
+
+      const uint8_t* data() const
+      {
+        return _data;
+      }
+
+      size_t size() const
+      {
+        return _size;
+      }
+
+    private:
+      const uint8_t* _data = nullptr;
+      size_t _size = 0;
     };
 
+#ifdef _WIN32
     struct decompressor_handle_traits
     {
       using type = DECOMPRESSOR_HANDLE;
@@ -49,267 +263,1373 @@ namespace ShaderGenerator
         return reinterpret_cast<type>(-1);
       }
     };
+#endif
+
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    struct zstd_deleter
+    {
+      void operator()(ZSTD_DDict* value) const noexcept
+      {
+        ZSTD_freeDDict(value);
+      }
+
+      void operator()(ZSTD_DCtx* value) const noexcept
+      {
+        ZSTD_freeDCtx(value);
+      }
+    };
+#endif
+
+    //Background threads shared by the asynchronous loads of every group
+    class load_pool
+    {
+    public:
+      explicit load_pool(size_t threadCount)
+      {
+        for (size_t i = 0; i < threadCount; i++)
+        {
+          _threads.emplace_back([this] { run_worker(); });
+        }
+      }
+
+      ~load_pool()
+      {
+        {
+          std::lock_guard lock(_mutex);
+          _isStopping = true;
+        }
+        _condition.notify_all();
+
+        for (auto& thread : _threads)
+        {
+          thread.join();
+        }
+      }
+
+      void submit(std::function<void()>&& task)
+      {
+        {
+          std::lock_guard lock(_mutex);
+          _tasks.push_back(std::move(task));
+        }
+        _condition.notify_one();
+      }
+
+      static load_pool& shared()
+      {
+        static load_pool pool{ std::max(std::thread::hardware_concurrency(), 1u) };
+        return pool;
+      }
+
+    private:
+      std::mutex _mutex;
+      std::condition_variable _condition;
+      std::deque<std::function<void()>> _tasks;
+      std::vector<std::thread> _threads;
+      bool _isStopping = false;
+
+      void run_worker()
+      {
+        while (true)
+        {
+          std::function<void()> task;
+          {
+            std::unique_lock lock(_mutex);
+            _condition.wait(lock, [&] { return _isStopping || !_tasks.empty(); });
+            if (_tasks.empty()) return;
+
+            task = std::move(_tasks.front());
+            _tasks.pop_front();
+          }
+
+          task();
+        }
+      }
+    };
+
+    //Asynchronous loads still referring to the group, the group waits for them before it is destroyed
+    struct pending_loads
+    {
+      std::mutex Mutex;
+      std::condition_variable Completed;
+      size_t Count = 0;
+    };
 #pragma endregion
 
 #pragma region Helper methods
+    //Reads a value at the specified offset of a buffer, the offsets come from the file so they are checked
     template<typename T>
-    static void ReadValue(std::istream& stream, T& value)
+    static T ReadValue(const uint8_t* data, size_t size, size_t offset)
     {
       static_assert(std::is_trivially_copyable_v<T>);
-      stream.read(reinterpret_cast<char*>(&value), sizeof(T));
-    }
+      if (offset > size || size - offset < sizeof(T)) throw std::runtime_error("Unexpected end of shader group data.");
 
-    template<typename T>
-    static auto ReadValue(std::istream& stream)
-    {
-      T value{};
-      ReadValue(stream, value);
+      T value;
+      memcpy(&value, data + offset, sizeof(T));
       return value;
     }
 
-    static void ReadVector(std::istream& stream, std::vector<uint8_t>& value)
+    template<typename T>
+    T ReadValue(size_t offset) const
     {
-      stream.read(reinterpret_cast<char*>(value.data()), value.size());
+      return ReadValue<T>(_file.data(), _file.size(), offset);
     }
 
-    static auto ReadString(std::istream& stream, uint32_t length)
+    //Returns the start of a range of the file after checking that it lies within the file
+    const uint8_t* ReadRange(uint64_t offset, uint64_t length) const
     {
-      std::string buffer(length, '\0');
-      stream.read(buffer.data(), buffer.size());
-      return winrt::to_hstring(buffer);
+      if (offset > _file.size() || _file.size() - offset < length) throw std::runtime_error("Unexpected end of shader group file.");
+      return _file.data() + offset;
     }
 #pragma endregion
 
   private:
+    //Size of the index entries
+    static const size_t BlockEntrySize = 32;
+    static const size_t FrameEntrySize = 12;
+    static const size_t AliasEntrySize = 12;
+    static const size_t RecordHeaderSize = 16;
+
+    //Container format revision
+    uint32_t _version = 0u;
+
     //Bitmask used to obtain block key from a shader key
     uint64_t _blockKeyMask = 0ull;
 
     //The start position of the first block
     uint64_t _blockOffset = 0ull;
 
-    //The backing shader stream
-    std::ifstream _shaderStream;
+    //The backing file
+    mapped_file _file;
+
+    //Tables of the index, they are searched in place in the mapped file
+    uint32_t _blockCount = 0u, _blobCount = 0u, _shaderCount = 0u, _frameCount = 0u;
+    size_t _blockTableOffset = 0, _frameTableOffset = 0, _aliasTableOffset = 0;
+
+    //Key layout and presence bitmap, they map keys to their alias index without searching
+    std::vector<KeyOption> _keyOptions;
+    uint64_t _keyBits = 0ull;
+    uint32_t _presenceWordCount = 0u;
+    size_t _presenceTableOffset = 0, _rankTableOffset = 0;
+
+    //Info about the shader blocks of legacy containers
+    std::unordered_map<uint64_t, ShaderBlockInfo> _legacyBlocks;
+
+    //Slots of the legacy shaders loaded so far, the other containers use the alias index as slot
+    std::unordered_map<uint64_t, uint32_t> _legacySlots;
+
+    //Sorted keys of groups created in memory, their position is their slot
+    std::vector<uint64_t> _memoryKeys;
+
+    //Dictionary shared by the frames of the container, points into the mapped file
+    const uint8_t* _dictionary = nullptr;
+    uint32_t _dictionaryLength = 0u;
+
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    std::unique_ptr<ZSTD_DDict, zstd_deleter> _zstdDictionary;
+    std::unique_ptr<std::once_flag> _zstdDictionaryFlag = std::make_unique<std::once_flag>();
+#endif
 
-    //Info about the shader blocks 
-    std::unordered_map<uint64_t, ShaderBlockInfo> _shaderBlocks;
+    //Blob index to the slot of a cached shader containing the blob
+    std::unordered_map<uint32_t, uint32_t> _loadedBlobs;
 
-    //The active shader block
-    std::optional<ShaderBlock> _activeBlock;
+    //Decompressed blocks and their keys, the most recently used first
+    std::unordered_map<uint64_t, CachedBlock> _blockCache;
+    std::list<uint64_t> _blockOrder;
 
-    //Shader cache
-    std::unordered_map<uint64_t, CompiledShader> _shaderCache;
+    //Every block decompressed so far, a block evicted from the cache stays alive while shaders point into it and is reused instead of being decompressed again
+    std::unordered_map<uint64_t, std::weak_ptr<const ShaderBlock>> _liveBlocks;
 
-    //Mutex for shader management - mutex cannot be moved
-    std::unique_ptr<std::mutex> _mutex = std::make_unique<std::mutex>();
+    //Shader cache by slot and the slots loaded from the file, the most recently loaded first
+    std::vector<std::unique_ptr<ShaderPage>> _shaderPages;
+    std::list<uint32_t> _shaderOrder;
+
+    //Buffers held by the cached blocks and shaders and their total size, requires the block lock
+    //Shaders point into their block, so an evicted block stays resident until its last cached shader is evicted as well
+    std::unordered_map<const void*, ResidentBuffer> _residentBuffers;
+    size_t _residentSize = 0;
+
+    //Cache limits and the clock ordering blocks and shaders by their last use
+    CompiledShaderCacheLimits _cacheLimits;
+    std::unique_ptr<std::atomic<uint64_t>> _useCounter = std::make_unique<std::atomic<uint64_t>>(0ull);
+
+    //The shader cache is read under a shared lock, the block cache lock is only held while looking up blocks, so blocks decompress in parallel
+    //Whenever both are needed the shader lock is taken first - mutexes cannot be moved
+    std::unique_ptr<std::shared_mutex> _shaderMutex = std::make_unique<std::shared_mutex>();
+    std::unique_ptr<std::mutex> _blockMutex = std::make_unique<std::mutex>();
+
+    std::unique_ptr<pending_loads> _pendingLoads = std::make_unique<pending_loads>();
 
     CompiledShaderGroup() = default;
     CompiledShaderGroup(CompiledShaderGroup&&) = default;
     CompiledShaderGroup& operator=(CompiledShaderGroup&&) = default;
 
-    static CompiledShader ReadShader(std::istream& reader, bool headerOnly = false)
+    //The bytecode of the result points into the block, the caller sets its storage
+    static CompiledShader ReadShader(std::span<const uint8_t> block, size_t offset)
     {
-      auto magic = ReadString(reader, 4);
-      if (magic != L"SH01")
+      if (offset > block.size() || block.size() - offset < RecordHeaderSize || memcmp(block.data() + offset, "SH01", 4) != 0)
       {
-        throw std::exception("Invalid compiled shader instance header.");
+        throw std::runtime_error("Invalid compiled shader instance header.");
       }
 
       CompiledShader shader;
-      ReadValue(reader, shader.Key);
-      ReadValue(reader, shader.Size);
-
-      if (!headerOnly)
-      {
-        shader.ByteCode.resize(shader.Size);
-        ReadVector(reader, shader.ByteCode);
-      }
+      shader.Key = ReadValue<uint64_t>(block.data(), block.size(), offset + 4);
+      shader.Size = ReadValue<uint32_t>(block.data(), block.size(), offset + 12);
+      if (block.size() - offset - RecordHeaderSize < shader.Size) throw std::runtime_error("Invalid compiled shader instance size.");
 
+      shader.ByteCode = block.subspan(offset + RecordHeaderSize, shader.Size);
       return shader;
     }
 
-    void ActivateBlock(uint64_t blockKey)
+    //Decodes an LZ4 block into the whole target, matches reaching before the target continue at the end of the dictionary
+    static bool DecompressLz4(std::span<const uint8_t> source, std::span<uint8_t> target, std::span<const uint8_t> dictionary)
     {
-      //Maybe the block is already loaded
-      if (_activeBlock && _activeBlock->Key == blockKey) return;
-
-      //Locate block info
-      auto& blockInfo = _shaderBlocks.at(blockKey);
+#ifdef SHADERGENERATOR_HAS_LZ4
+      auto decompressedLength = LZ4_decompress_safe_usingDict(reinterpret_cast<const char*>(source.data()), reinterpret_cast<char*>(target.data()), int(source.size()), int(target.size()), reinterpret_cast<const char*>(dictionary.data()), int(dictionary.size()));
+      return decompressedLength == int(target.size());
+#else
+      auto input = source.data(), inputEnd = input + source.size();
+      auto output = target.data(), outputEnd = output + target.size();
 
-      //Seek to the start of the compressed block
-      _shaderStream.seekg(_blockOffset + blockInfo.CompressedOffset);
+      //Lengths of 15 continue in the following bytes until one is below 255
+      auto readLength = [&](size_t& length) {
+        if (length != 15) return true;
 
-      ShaderBlock uncompressedBlock;
-      uncompressedBlock.Key = blockKey;
+        uint8_t value;
+        do
+        {
+          if (input == inputEnd) return false;
+          value = *input++;
+          length += value;
+        } while (value == 255);
+        return true;
+      };
 
-      //Decompress block
+      while (input != inputEnd)
       {
-        //Read the compressed data from the file
-        std::string compressedBuffer(size_t(blockInfo.CompressedLength), '\0');
-        _shaderStream.read(compressedBuffer.data(), compressedBuffer.size());
+        auto token = *input++;
+
+        //Literals
+        size_t literalLength = token >> 4;
+        if (!readLength(literalLength) || size_t(inputEnd - input) < literalLength || size_t(outputEnd - output) < literalLength) return false;
+
+        memcpy(output, input, literalLength);
+        input += literalLength;
+        output += literalLength;
 
-        //Create decompressor
-        winrt::handle_type<decompressor_handle_traits> decompressor;
-        winrt::check_bool(CreateDecompressor(COMPRESS_ALGORITHM_LZMS, nullptr, decompressor.put()));
+        //The last sequence has no match
+        if (input == inputEnd) break;
 
-        //Get the decompressed length
-        SIZE_T decompressedLength = 0;
-        Decompress(decompressor.get(), compressedBuffer.data(), compressedBuffer.size(), nullptr, 0, &decompressedLength);
-        if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+        //Match
+        if (inputEnd - input < 2) return false;
+        size_t offset = size_t(input[0]) | (size_t(input[1]) << 8);
+        input += 2;
+
+        size_t matchLength = token & 15;
+        if (!readLength(matchLength)) return false;
+        matchLength += 4;
+        if (offset == 0 || size_t(outputEnd - output) < matchLength) return false;
+
+        auto position = size_t(output - target.data());
+        if (offset > position)
         {
-          winrt::throw_last_error();
-        }
+          auto dictionaryOffset = offset - position;
+          if (dictionaryOffset > dictionary.size()) return false;
 
-        //Decompress the data
-        std::string decompressedBuffer(decompressedLength, '\0');
-        winrt::check_bool(Decompress(decompressor.get(), compressedBuffer.data(), compressedBuffer.size(), decompressedBuffer.data(), decompressedBuffer.size(), &decompressedLength));
+          auto dictionaryLength = std::min(dictionaryOffset, matchLength);
+          memcpy(output, dictionary.data() + dictionary.size() - dictionaryOffset, dictionaryLength);
+          output += dictionaryLength;
+          matchLength -= dictionaryLength;
+        }
 
-        //Store it in the decompressed stream
-        uncompressedBlock.Block.write(decompressedBuffer.data(), decompressedLength);
-        uncompressedBlock.Block.seekg(0);
+        //Overlapping matches repeat the bytes just written, so they are copied one by one
+        auto match = output - offset;
+        if (offset >= matchLength)
+        {
+          memcpy(output, match, matchLength);
+        }
+        else
+        {
+          for (size_t i = 0; i < matchLength; i++) output[i] = match[i];
+        }
+        output += matchLength;
       }
 
-      //Load shader offsets
+      return output == outputEnd;
+#endif
+    }
+
+    ShaderBlockInfo ReadBlockInfo(uint32_t blockIndex) const
+    {
+      auto offset = _blockTableOffset + size_t(blockIndex) * BlockEntrySize;
+
+      ShaderBlockInfo result;
+      result.CompressedOffset = ReadValue<uint64_t>(offset);
+      result.CompressedLength = ReadValue<uint64_t>(offset + 8);
+      result.FirstBlob = ReadValue<uint32_t>(offset + 16);
+      result.ShaderCount = ReadValue<uint32_t>(offset + 20);
+      result.Codec = ReadValue<BlockCodec>(offset + 24);
+      result.UncompressedLength = ReadValue<uint32_t>(offset + 28);
+      return result;
+    }
+
+    //Binary searches the blocks sorted by their first blob
+    uint32_t FindBlock(uint32_t blobIndex) const
+    {
+      uint32_t first = 0, count = _blockCount;
+      while (count > 0)
       {
-        for (uint32_t i = 0; i < blockInfo.ShaderCount; ++i)
+        auto step = count / 2;
+        if (ReadValue<uint32_t>(_blockTableOffset + size_t(first + step) * BlockEntrySize + 16) <= blobIndex)
+        {
+          first += step + 1;
+          count -= step + 1;
+        }
+        else
         {
-          auto shaderStart = uncompressedBlock.Block.tellg();
-          CompiledShader shader = ReadShader(uncompressedBlock.Block, true);
+          count = step;
+        }
+      }
+
+      if (first == 0) throw std::runtime_error("Invalid shader blob index.");
+      return first - 1;
+    }
 
-          uncompressedBlock.ShaderOffsets[shader.Key] = shaderStart;
-          uncompressedBlock.Block.seekg(std::streamoff(shader.Size), std::ios_base::cur);
+    //Binary searches the aliases sorted by key
+    std::optional<uint32_t> SearchAlias(uint64_t key) const
+    {
+      uint32_t first = 0, count = _shaderCount;
+      while (count > 0)
+      {
+        auto step = count / 2;
+        if (ReadValue<uint64_t>(_aliasTableOffset + size_t(first + step) * AliasEntrySize) < key)
+        {
+          first += step + 1;
+          count -= step + 1;
+        }
+        else
+        {
+          count = step;
         }
       }
 
-      //Replace the cached uncompressed block
-      _activeBlock = std::move(uncompressedBlock);
+      if (first == _shaderCount || ReadValue<uint64_t>(_aliasTableOffset + size_t(first) * AliasEntrySize) != key) return std::nullopt;
+      return first;
     }
 
-    CompiledShader LoadShader(uint64_t key)
+    //Returns the alias index of the key, the dense index of the key selects its bit in the presence bitmap and the rank of the bit is the alias index
+    std::optional<uint32_t> FindAlias(uint64_t key) const
     {
-      //Active the appropriate block
-      auto blockKey = key & _blockKeyMask;
-      ActivateBlock(blockKey);
+      if (!_presenceWordCount) return SearchAlias(key);
 
-      //Load the shader
-      auto shaderOffset = _activeBlock->ShaderOffsets.at(key);
-      _activeBlock->Block.seekg(shaderOffset);
+      uint64_t denseIndex = 0;
+      for (auto& option : _keyOptions)
+      {
+        auto digit = (key >> option.BitOffset) & option.Mask;
+        if (digit >= option.Radix) return std::nullopt;
 
-      auto result = ReadShader(_activeBlock->Block);
+        denseIndex += digit * option.Stride;
+      }
 
-      //Return the result
-      return result;
+      auto wordIndex = denseIndex / 64;
+      if ((key & ~_keyBits) || wordIndex >= _presenceWordCount) return std::nullopt;
+
+      auto word = ReadValue<uint64_t>(_presenceTableOffset + size_t(wordIndex) * 8);
+      auto bitMask = uint64_t(1) << (denseIndex % 64);
+      if (!(word & bitMask)) return std::nullopt;
+
+      auto aliasIndex = ReadValue<uint32_t>(_rankTableOffset + size_t(wordIndex) * 4) + uint32_t(std::popcount(word & (bitMask - 1)));
+      if (aliasIndex >= _shaderCount) return std::nullopt;
+      return aliasIndex;
     }
 
-  public:
-    CompiledShaderGroup(std::vector<CompiledShader>&& shaders)
+    uint32_t ReadAliasBlob(uint32_t aliasIndex) const
+    {
+      auto blobIndex = ReadValue<uint32_t>(_aliasTableOffset + size_t(aliasIndex) * AliasEntrySize + 8);
+      if (blobIndex >= _blobCount) throw std::runtime_error("Invalid shader blob index.");
+      return blobIndex;
+    }
+
+    //Returns the key of the block containing the shader or nothing if the key is not found
+    std::optional<uint64_t> FindBlockKey(uint64_t key) const
     {
-      for (auto& shader : shaders)
+      try
+      {
+        switch (_version)
+        {
+        case 3:
+        {
+          auto blockKey = key & _blockKeyMask;
+          if (_legacyBlocks.count(blockKey)) return blockKey;
+          break;
+        }
+        case 4:
+        {
+          auto aliasIndex = FindAlias(key);
+          if (aliasIndex) return FindBlock(ReadAliasBlob(*aliasIndex));
+          break;
+        }
+        }
+      }
+      catch (...)
       {
-        _shaderCache[shader.Key] = std::move(shader);
       }
+
+      return std::nullopt;
     }
 
-    static CompiledShaderGroup FromFile(const std::filesystem::path& path)
+    ShaderBlock DecompressBlock(const ShaderBlockInfo& blockInfo) const
     {
-      CompiledShaderGroup result;
+      ShaderBlock uncompressedBlock;
 
-      try
+      //Decompress the block directly from the mapped file
       {
-        //Open file
+        auto compressedData = ReadRange(_blockOffset + blockInfo.CompressedOffset, blockInfo.CompressedLength);
+        auto compressedLength = size_t(blockInfo.CompressedLength);
+
+        auto& decompressedBuffer = uncompressedBlock.Data;
+        switch (blockInfo.Codec)
+        {
+        case BlockCodec::Stored:
+          decompressedBuffer.assign(compressedData, compressedData + compressedLength);
+          break;
+#ifdef _WIN32
+        case BlockCodec::Lzms:
         {
-          auto preferredPath = path;
-          preferredPath.make_preferred();
+          //Create decompressor
+          winrt::handle_type<decompressor_handle_traits> decompressor;
+          winrt::check_bool(CreateDecompressor(COMPRESS_ALGORITHM_LZMS, nullptr, decompressor.put()));
 
-          std::ifstream stream(preferredPath.string().c_str(), std::ios::binary);
-          if (!stream.is_open()) throw std::runtime_error("Failed to open shader group file!");
+          //Get the decompressed length, older containers do not store it
+          SIZE_T decompressedLength = blockInfo.UncompressedLength;
+          if (!decompressedLength)
+          {
+            Decompress(decompressor.get(), compressedData, compressedLength, nullptr, 0, &decompressedLength);
+            if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+            {
+              winrt::throw_last_error();
+            }
+          }
 
-          //Enough to check eofbit and badbit, the latter signals read/write errors.
-          //Since we only read raw bytes and we don't use the >> operator, logical errors can't occur, so no need to check failbit.
-          stream.exceptions(std::ios_base::eofbit | std::ios_base::badbit);
+          //Decompress the data
+          decompressedBuffer.resize(decompressedLength);
+          winrt::check_bool(Decompress(decompressor.get(), compressedData, compressedLength, decompressedBuffer.data(), decompressedBuffer.size(), &decompressedLength));
+          decompressedBuffer.resize(decompressedLength);
+          break;
+        }
+#endif
+        case BlockCodec::Lz4:
+        {
+          decompressedBuffer.resize(blockInfo.UncompressedLength);
+          if (!DecompressLz4({ compressedData, compressedLength }, decompressedBuffer, {})) throw std::runtime_error("Failed to decompress LZ4 shader block.");
+          break;
+        }
+#ifdef SHADERGENERATOR_HAS_ZSTD
+        case BlockCodec::Zstd:
+        {
+          decompressedBuffer.resize(blockInfo.UncompressedLength);
+          auto decompressedLength = ZSTD_decompress(decompressedBuffer.data(), decompressedBuffer.size(), compressedData, compressedLength);
+          if (ZSTD_isError(decompressedLength) || decompressedLength != decompressedBuffer.size()) throw std::runtime_error("Failed to decompress Zstandard shader block.");
+          break;
+        }
+#endif
+        default:
+          throw std::runtime_error("Unsupported shader block codec.");
+        }
+      }
 
-          result._shaderStream = move(stream);
+      //Legacy containers have no record table, so their records are scanned and searched by shader key
+      if (_version == 3)
+      {
+        std::vector<std::pair<uint64_t, uint32_t>> legacyRecords;
+        size_t offset = 0;
+        for (uint32_t i = 0; i < blockInfo.ShaderCount; ++i)
+        {
+          auto shader = ReadShader(uncompressedBlock.Data, offset);
+          legacyRecords.emplace_back(shader.Key, uint32_t(offset));
+          offset += RecordHeaderSize + shader.Size;
         }
 
-        //Parse file
+        std::sort(legacyRecords.begin(), legacyRecords.end());
+        for (auto& [recordKey, recordOffset] : legacyRecords)
         {
-          auto& stream = result._shaderStream;
+          uncompressedBlock.RecordKeys.push_back(recordKey);
+          uncompressedBlock.RecordOffsets.push_back(recordOffset);
+        }
+      }
 
-          //Check header
-          auto magic = ReadString(stream, 4);
-          if (magic != L"CSG3")
-          {
-            throw std::runtime_error("Invalid compiled shader group file header.");
-          }
+      return uncompressedBlock;
+    }
 
-          //Read block index mask and block count
-          ReadValue(stream, result._blockKeyMask);
-          auto blockCount = ReadValue<uint32_t>(stream);
+    std::shared_ptr<const ShaderBlock> ActivateBlock(uint64_t blockKey, const ShaderBlockInfo& blockInfo)
+    {
+      std::promise<std::shared_ptr<const ShaderBlock>> loader;
+      std::shared_future<std::shared_ptr<const ShaderBlock>> block;
+      uint64_t loadId = 0ull;
 
-          //Read block infos
-          result._shaderBlocks.reserve(blockCount);
+      {
+        std::lock_guard lock(*_blockMutex);
 
-          ShaderBlockInfo* previousBlock = nullptr;
-          for (uint32_t i = 0; i < blockCount; ++i)
-          {
-            auto key = ReadValue<uint64_t>(stream);
-            auto& currentBlock = result._shaderBlocks[key];
-            ReadValue(stream, currentBlock.CompressedOffset);
-            ReadValue(stream, currentBlock.ShaderCount);
+        //Maybe the block is already loaded or being loaded by another thread
+        auto cachedBlock = _blockCache.find(blockKey);
+        if (cachedBlock != _blockCache.end())
+        {
+          auto& entry = cachedBlock->second;
+          _blockOrder.splice(_blockOrder.begin(), _blockOrder, entry.Position);
+          entry.LastUse = ++*_useCounter;
+          block = entry.Block;
+        }
+        else
+        {
+          //Otherwise this thread loads it, unless its shaders still keep it alive, the least recently used blocks are evicted once over the limit
+          block = loader.get_future().share();
+
+          auto liveBlock = _liveBlocks.find(blockKey);
+          auto residentBlock = liveBlock != _liveBlocks.end() ? liveBlock->second.lock() : nullptr;
 
-            if (previousBlock) previousBlock->CompressedLength = currentBlock.CompressedOffset - previousBlock->CompressedOffset;
-            previousBlock = &currentBlock;
+          auto useId = ++*_useCounter;
+          if (residentBlock)
+          {
+            loader.set_value(residentBlock);
+            AddResidentReference(residentBlock.get(), residentBlock->Data.size());
+          }
+          else
+          {
+            loadId = useId;
           }
 
-          result._blockOffset = stream.tellg();
+          _blockOrder.push_front(blockKey);
+          _blockCache.emplace(blockKey, CachedBlock{ block, useId, useId, residentBlock.get(), _blockOrder.begin() });
 
-          stream.seekg(0, std::ios_base::end);
-          if (previousBlock) previousBlock->CompressedLength = stream.tellg() - std::streamoff(result._blockOffset + previousBlock->CompressedOffset);
+          while (_blockCache.size() > std::max<size_t>(_cacheLimits.BlockCount, 1))
+          {
+            EvictBlock();
+          }
         }
-
       }
-      catch (...)
+
+      if (loadId)
       {
-        throw std::runtime_error("Failed to open compiled shader group file.");
+        //Decompress without holding any lock
+        try
+        {
+          auto uncompressedBlock = std::make_shared<const ShaderBlock>(DecompressBlock(blockInfo));
+          loader.set_value(uncompressedBlock);
+
+          //Count the block into the cache size unless it was evicted meanwhile
+          std::lock_guard lock(*_blockMutex);
+          _liveBlocks[blockKey] = uncompressedBlock;
+
+          auto cachedBlock = _blockCache.find(blockKey);
+          if (cachedBlock != _blockCache.end() && cachedBlock->second.LoadId == loadId)
+          {
+            cachedBlock->second.Buffer = uncompressedBlock.get();
+            AddResidentReference(uncompressedBlock.get(), uncompressedBlock->Data.size());
+          }
+        }
+        catch (...)
+        {
+          loader.set_exception(std::current_exception());
+
+          //Failed blocks are not cached, so the next request tries again
+          std::lock_guard lock(*_blockMutex);
+          auto cachedBlock = _blockCache.find(blockKey);
+          if (cachedBlock != _blockCache.end() && cachedBlock->second.LoadId == loadId)
+          {
+            _blockOrder.erase(cachedBlock->second.Position);
+            _blockCache.erase(cachedBlock);
+          }
+        }
       }
 
-      return result;
+      return block.get();
     }
 
-    const std::unordered_map<uint64_t, CompiledShader>& Shaders() const
+    //Requires the block lock
+    void AddResidentReference(const void* buffer, size_t size)
     {
-      return _shaderCache;
+      auto [residentBuffer, isAdded] = _residentBuffers.try_emplace(buffer, ResidentBuffer{ size, 0 });
+      if (isAdded) _residentSize += size;
+      residentBuffer->second.ReferenceCount++;
     }
 
-    const CompiledShader* Shader(uint64_t key)
+    //Requires the block lock
+    void ReleaseResidentReference(const void* buffer)
     {
-      try
-      {
-        std::lock_guard lock(*_mutex);
-
-        auto& shader = _shaderCache[key];
-        if (!shader.Size)
-        {
-          shader = LoadShader(key);
-        }
+      auto residentBuffer = _residentBuffers.find(buffer);
+      if (residentBuffer == _residentBuffers.end() || --residentBuffer->second.ReferenceCount > 0) return;
 
-        return &shader;
-      }
-      catch (...)
-      {
-        return nullptr;
-      }
+      _residentSize -= residentBuffer->second.Size;
+      _residentBuffers.erase(residentBuffer);
     }
 
-    template<typename T>
-    const CompiledShader* Shader(T key)
+    //Requires the block lock
+    void EvictBlock()
     {
-      return Shader(uint64_t(key));
+      auto cachedBlock = _blockCache.find(_blockOrder.back());
+      if (cachedBlock->second.Buffer) ReleaseResidentReference(cachedBlock->second.Buffer);
+      _blockCache.erase(cachedBlock);
+      _blockOrder.pop_back();
     }
 
-    void ClearCache()
+    //Requires the exclusive shader lock and the block lock
+    void EvictShader()
     {
-      _shaderCache.clear();
-      _activeBlock.reset();
+      auto slot = _shaderOrder.back();
+      auto& entry = *FindCachedShader(slot);
+
+      //Shaders handed out stay valid, they are released by their last owner
+      ReleaseResidentReference(entry.Shader->Storage.get());
+      if (_version == 4)
+      {
+        auto loadedBlob = _loadedBlobs.find(ReadAliasBlob(slot));
+        if (loadedBlob != _loadedBlobs.end() && loadedBlob->second == slot) _loadedBlobs.erase(loadedBlob);
+      }
+
+      entry.Shader.reset();
+      entry.IsReferenced = false;
+      _shaderOrder.pop_back();
+    }
+
+    //Evicts the least recently used blocks and shaders until the cache fits into its budget, requires both locks
+    void TrimCache()
+    {
+      if (!_cacheLimits.ByteBudget) return;
+
+      while (_residentSize > _cacheLimits.ByteBudget)
+      {
+        //Shaders looked up since they were last checked move to the front instead of being evicted
+        while (!_shaderOrder.empty())
+        {
+          auto& entry = *FindCachedShader(_shaderOrder.back());
+          if (!entry.IsReferenced.exchange(false, std::memory_order_relaxed)) break;
+
+          entry.LastUse = ++*_useCounter;
+          _shaderOrder.splice(_shaderOrder.begin(), _shaderOrder, std::prev(_shaderOrder.end()));
+        }
+
+        auto canEvictBlock = !_blockOrder.empty();
+        auto canEvictShader = !_shaderOrder.empty();
+        if (canEvictBlock && canEvictShader)
+        {
+          if (_blockCache.at(_blockOrder.back()).LastUse < FindCachedShader(_shaderOrder.back())->LastUse) EvictBlock();
+          else EvictShader();
+        }
+        else if (canEvictBlock)
+        {
+          EvictBlock();
+        }
+        else if (canEvictShader)
+        {
+          EvictShader();
+        }
+        else
+        {
+          break;
+        }
+      }
+    }
+
+#ifdef SHADERGENERATOR_HAS_ZSTD
+    //Decompression contexts cannot be shared between threads, so each thread has its own
+    static ZSTD_DCtx* ZstdContext()
+    {
+      thread_local std::unique_ptr<ZSTD_DCtx, zstd_deleter> context{ ZSTD_createDCtx() };
+      return context.get();
+    }
+#endif
+
+    //Frames are located in the compressed block, records in the decompressed one
+    ShaderFrameInfo ReadFrameInfo(uint32_t blobIndex) const
+    {
+      if (blobIndex >= _frameCount) throw std::runtime_error("Invalid shader frame index.");
+      auto frameOffset = _frameTableOffset + size_t(blobIndex) * FrameEntrySize;
+
+      ShaderFrameInfo result;
+      result.Offset = ReadValue<uint32_t>(frameOffset);
+      result.Length = ReadValue<uint32_t>(frameOffset + 4);
+      result.Size = ReadValue<uint32_t>(frameOffset + 8);
+      return result;
+    }
+
+    CompiledShader LoadFrame(const ShaderFrameInfo& frameInfo, const ShaderBlockInfo& blockInfo)
+    {
+      auto compressedData = ReadRange(blockInfo.CompressedOffset + frameInfo.Offset, frameInfo.Length);
+
+      //Frames are decompressed into a buffer of their own
+      auto byteCode = std::make_shared<std::vector<uint8_t>>(frameInfo.Size);
+
+      //Decompress only the requested shader
+      switch (blockInfo.Codec)
+      {
+      case BlockCodec::Lz4Frames:
+      {
+        if (!DecompressLz4({ compressedData, frameInfo.Length }, *byteCode, { _dictionary, _dictionaryLength })) throw std::runtime_error("Failed to decompress LZ4 shader frame.");
+        break;
+      }
+#ifdef SHADERGENERATOR_HAS_ZSTD
+      case BlockCodec::ZstdFrames:
+      {
+        //The digested dictionary is read-only, so every thread uses the same one
+        std::call_once(*_zstdDictionaryFlag, [&] { _zstdDictionary.reset(ZSTD_createDDict(_dictionary, _dictionaryLength)); });
+
+        auto decompressedLength = ZSTD_decompress_usingDDict(ZstdContext(), byteCode->data(), byteCode->size(), compressedData, frameInfo.Length, _zstdDictionary.get());
+        if (ZSTD_isError(decompressedLength) || decompressedLength != byteCode->size()) throw std::runtime_error("Failed to decompress Zstandard shader frame.");
+        break;
+      }
+#endif
+      default:
+        throw std::runtime_error("Unsupported shader frame codec.");
+      }
+
+      CompiledShader shader;
+      shader.Size = frameInfo.Size;
+      shader.ByteCode = *byteCode;
+      shader.Storage = std::move(byteCode);
+      return shader;
+    }
+
+    //Also returns the size of the buffer the shader keeps alive, which is its whole block for shaders read from a block
+    CompiledShader LoadShader(uint64_t key, std::optional<uint32_t> slot, std::shared_ptr<const ShaderBlock>& block, size_t& storageSize)
+    {
+      //Locate the block and the record containing the shader
+      uint64_t blockKey, recordKey;
+      size_t recordOffset = 0;
+      ShaderBlockInfo blockInfo;
+      if (_version == 3)
+      {
+        blockKey = key & _blockKeyMask;
+        recordKey = key;
+        blockInfo = _legacyBlocks.at(blockKey);
+      }
+      else
+      {
+        if (_version != 4 || !slot) throw std::out_of_range("Shader key not found.");
+        auto blobIndex = ReadAliasBlob(*slot);
+
+        //The same bytecode might be already loaded under a different key
+        {
+          std::shared_lock lock(*_shaderMutex);
+          auto loadedBlob = _loadedBlobs.find(blobIndex);
+          if (loadedBlob != _loadedBlobs.end())
+          {
+            auto result = *FindCachedShader(loadedBlob->second)->Shader;
+            result.Key = key;
+
+            //The cached shader holds a reference, so its buffer is resident unless the cache was cleared meanwhile
+            std::lock_guard blockLock(*_blockMutex);
+            auto residentBuffer = _residentBuffers.find(result.Storage.get());
+            storageSize = residentBuffer != _residentBuffers.end() ? residentBuffer->second.Size : result.ByteCode.size();
+            return result;
+          }
+        }
+
+        blockKey = FindBlock(blobIndex);
+        recordKey = blobIndex;
+        blockInfo = ReadBlockInfo(uint32_t(blockKey));
+        CheckCodec(blockInfo.Codec);
+        auto frameInfo = ReadFrameInfo(blobIndex);
+
+        //Frames are decoded on their own, without the rest of their block
+        if (blockInfo.Codec == BlockCodec::Lz4Frames || blockInfo.Codec == BlockCodec::ZstdFrames)
+        {
+          auto result = LoadFrame(frameInfo, blockInfo);
+          result.Key = key;
+          storageSize = result.ByteCode.size();
+          return result;
+        }
+
+        recordOffset = frameInfo.Offset;
+      }
+
+      //Active the appropriate block
+      if (!block) block = ActivateBlock(blockKey, blockInfo);
+
+      //Load the shader, records of the current container are read straight from the offset listed in the index
+      if (_version == 3) recordOffset = block->FindRecord(recordKey);
+
+      //The shader points into the block and keeps it alive, so the bytecode is not copied
+      auto result = ReadShader(block->Data, recordOffset);
+      if (result.Key != recordKey) throw std::runtime_error("Invalid shader record index.");
+      result.Key = key;
+      result.Storage = block;
+      storageSize = block->Data.size();
+
+      //Return the result
+      return result;
+    }
+
+    //Runs the task on the shared load pool, the task must not throw
+    void SubmitLoad(std::function<void()>&& task)
+    {
+      {
+        std::lock_guard lock(_pendingLoads->Mutex);
+        _pendingLoads->Count++;
+      }
+
+      load_pool::shared().submit([this, task = std::move(task)] {
+        task();
+
+        //The group might be destroyed as soon as the count reaches zero, so it is not touched afterwards
+        std::lock_guard lock(_pendingLoads->Mutex);
+        if (--_pendingLoads->Count == 0) _pendingLoads->Completed.notify_all();
+      });
+    }
+
+    //Returns the cache slot of the key, legacy shaders get their slot once loaded, requires the shader lock
+    std::optional<uint32_t> FindSlot(uint64_t key) const
+    {
+      switch (_version)
+      {
+      case 3:
+      {
+        auto slot = _legacySlots.find(key);
+        if (slot != _legacySlots.end()) return slot->second;
+        return std::nullopt;
+      }
+      case 4:
+        return FindAlias(key);
+      default:
+      {
+        auto position = std::lower_bound(_memoryKeys.begin(), _memoryKeys.end(), key);
+        if (position != _memoryKeys.end() && *position == key) return uint32_t(position - _memoryKeys.begin());
+        return std::nullopt;
+      }
+      }
+    }
+
+    //Returns the cache entry of the slot or null if its page is not allocated, requires the shader lock
+    CachedShader* FindCachedShader(uint32_t slot) const
+    {
+      auto pageIndex = slot / ShaderPageSize;
+      if (pageIndex >= _shaderPages.size() || !_shaderPages[pageIndex]) return nullptr;
+      return &_shaderPages[pageIndex]->Shaders[slot % ShaderPageSize];
+    }
+
+    //Returns the cache entry of the slot and allocates its page as needed, requires the exclusive shader lock
+    CachedShader& AddCachedShader(uint32_t slot)
+    {
+      auto pageIndex = slot / ShaderPageSize;
+      if (pageIndex >= _shaderPages.size()) _shaderPages.resize(pageIndex + 1);
+
+      auto& page = _shaderPages[pageIndex];
+      if (!page) page = std::make_unique<ShaderPage>();
+      return page->Shaders[slot % ShaderPageSize];
+    }
+
+    //Returns the cached shader of the key and marks it as used, requires the shader lock
+    std::shared_ptr<const CompiledShader> GetCachedShader(std::optional<uint32_t> slot) const
+    {
+      auto entry = slot ? FindCachedShader(*slot) : nullptr;
+      if (!entry || !entry->Shader) return nullptr;
+
+      //Only written when it changes, so hot shaders do not bounce their cache line between threads
+      if (!entry->IsReferenced.load(std::memory_order_relaxed)) entry->IsReferenced.store(true, std::memory_order_relaxed);
+      return entry->Shader;
+    }
+
+    //Returns the shader from the cache or loads it, the block is activated on first use and reused by later calls for shaders of the same block
+    std::shared_ptr<const CompiledShader> FindShader(uint64_t key, std::shared_ptr<const ShaderBlock>& block)
+    {
+      try
+      {
+        std::optional<uint32_t> slot;
+        {
+          std::shared_lock lock(*_shaderMutex);
+
+          slot = FindSlot(key);
+          auto cachedShader = GetCachedShader(slot);
+          if (cachedShader) return cachedShader;
+
+          //Only legacy shaders can be present without a slot
+          if (!slot && _version != 3) return nullptr;
+        }
+
+        //Load the shader without holding any lock
+        size_t storageSize = 0;
+        auto shader = std::make_shared<const CompiledShader>(LoadShader(key, slot, block, storageSize));
+
+        std::unique_lock lock(*_shaderMutex);
+        if (!slot) slot = _legacySlots.try_emplace(key, uint32_t(_legacySlots.size())).first->second;
+
+        //Another thread might have loaded the same shader meanwhile
+        auto& entry = AddCachedShader(*slot);
+        if (entry.Shader) return entry.Shader;
+
+        entry.Shader = shader;
+        entry.LastUse = ++*_useCounter;
+
+        _shaderOrder.push_front(*slot);
+        if (_version == 4) _loadedBlobs.try_emplace(ReadAliasBlob(*slot), *slot);
+
+        std::lock_guard blockLock(*_blockMutex);
+        AddResidentReference(shader->Storage.get(), storageSize);
+        TrimCache();
+        return shader;
+      }
+      catch (const CompiledShaderCodecError&)
+      {
+        throw;
+      }
+      catch (...)
+      {
+        return nullptr;
+      }
+    }
+
+    void ReadLegacyIndex()
+    {
+      //Read block index mask and block count
+      size_t offset = 4;
+      _blockKeyMask = ReadValue<uint64_t>(offset);
+      auto blockCount = ReadValue<uint32_t>(offset + 8);
+      offset += 12;
+
+      //Read block infos
+      _legacyBlocks.reserve(blockCount);
+
+      ShaderBlockInfo* previousBlock = nullptr;
+      for (uint32_t i = 0; i < blockCount; ++i)
+      {
+        auto key = ReadValue<uint64_t>(offset);
+        auto& currentBlock = _legacyBlocks[key];
+        currentBlock.CompressedOffset = ReadValue<uint64_t>(offset + 8);
+        currentBlock.ShaderCount = ReadValue<uint32_t>(offset + 16);
+        offset += 20;
+
+        if (previousBlock) previousBlock->CompressedLength = currentBlock.CompressedOffset - previousBlock->CompressedOffset;
+        previousBlock = &currentBlock;
+      }
+
+      _blockOffset = offset;
+      if (previousBlock) previousBlock->CompressedLength = _file.size() - (_blockOffset + previousBlock->CompressedOffset);
+    }
+
+    void ReadIndex()
+    {
+      //Only the header of the index is read, the tables are searched on demand
+      size_t offset = size_t(ReadValue<uint64_t>(4));
+      _blockCount = ReadValue<uint32_t>(offset);
+      _blobCount = ReadValue<uint32_t>(offset + 4);
+      _shaderCount = ReadValue<uint32_t>(offset + 8);
+      _frameCount = ReadValue<uint32_t>(offset + 12);
+      _dictionaryLength = ReadValue<uint32_t>(offset + 16);
+      offset += 20;
+
+      _dictionary = ReadRange(offset, _dictionaryLength);
+      offset += _dictionaryLength;
+
+      //Key layout, the options are few so they are read upfront
+      auto keyOptionCount = ReadValue<uint32_t>(offset);
+      offset += 4;
+
+      uint64_t stride = 1;
+      for (uint32_t i = 0; i < keyOptionCount; i++)
+      {
+        KeyOption option;
+        option.BitOffset = ReadValue<uint32_t>(offset);
+        option.Radix = ReadValue<uint32_t>(offset + 4);
+        option.Stride = stride;
+        offset += 8;
+
+        auto bitCount = option.Radix > 1 ? std::bit_width(option.Radix - 1) : 0;
+        if (option.BitOffset + bitCount > 32) throw std::runtime_error("Invalid shader key layout.");
+
+        option.Mask = (uint64_t(1) << bitCount) - 1;
+        _keyBits |= option.Mask << option.BitOffset;
+        stride *= option.Radix;
+        _keyOptions.push_back(option);
+      }
+
+      //Every blob is listed in the record table
+      if (_frameCount != _blobCount) throw std::runtime_error("Invalid shader record table.");
+
+      _presenceWordCount = ReadValue<uint32_t>(offset);
+      _presenceTableOffset = offset + 4;
+      _rankTableOffset = _presenceTableOffset + size_t(_presenceWordCount) * 8;
+      offset = _rankTableOffset + size_t(_presenceWordCount) * 4;
+      ReadRange(_presenceTableOffset, offset - _presenceTableOffset);
+
+      _blockTableOffset = offset;
+      _frameTableOffset = _blockTableOffset + size_t(_blockCount) * BlockEntrySize;
+      _aliasTableOffset = _frameTableOffset + size_t(_frameCount) * FrameEntrySize;
+
+      //Validate that the tables fit into the file
+      ReadRange(_blockTableOffset, _aliasTableOffset + size_t(_shaderCount) * AliasEntrySize - _blockTableOffset);
+    }
+
+    static bool IsCodecSupported(BlockCodec codec)
+    {
+      switch (codec)
+      {
+      case BlockCodec::Stored:
+      case BlockCodec::Lz4:
+      case BlockCodec::Lz4Frames:
+        return true;
+#ifdef _WIN32
+      case BlockCodec::Lzms:
+        return true;
+#endif
+#ifdef SHADERGENERATOR_HAS_ZSTD
+      case BlockCodec::Zstd:
+      case BlockCodec::ZstdFrames:
+        return true;
+#endif
+      default:
+        return false;
+      }
+    }
+
+    //Codecs are checked as their blocks are loaded, so opening a group does not read its block table
+    static void CheckCodec(BlockCodec codec)
+    {
+      if (IsCodecSupported(codec)) return;
+      if (codec == BlockCodec::Lzms) throw CompiledShaderCodecError("Compiled shader group uses LZMS compression, which is only supported on Windows.");
+      throw CompiledShaderCodecError("Compiled shader group uses block codec " + std::to_string(uint32_t(codec)) + ", which is not supported by this build of the loader.");
+    }
+
+  public:
+    ~CompiledShaderGroup()
+    {
+      //Background loads use the group, so they are waited for
+      if (!_pendingLoads) return;
+
+      std::unique_lock lock(_pendingLoads->Mutex);
+      _pendingLoads->Completed.wait(lock, [&] { return _pendingLoads->Count == 0; });
+    }
+
+    CompiledShaderGroup(std::vector<CompiledShader>&& shaders)
+    {
+      //The slots follow the key order, the last shader wins if a key repeats
+      std::stable_sort(shaders.begin(), shaders.end(), [](const CompiledShader& a, const CompiledShader& b) { return a.Key < b.Key; });
+      for (size_t i = 0; i < shaders.size(); i++)
+      {
+        if (i + 1 < shaders.size() && shaders[i + 1].Key == shaders[i].Key) continue;
+
+        auto slot = uint32_t(_memoryKeys.size());
+        _memoryKeys.push_back(shaders[i].Key);
+        AddCachedShader(slot).Shader = std::make_shared<const CompiledShader>(std::move(shaders[i]));
+      }
+    }
+
+    static CompiledShaderGroup FromFile(const std::filesystem::path& path, const CompiledShaderCacheLimits& cacheLimits = {})
+    {
+      CompiledShaderGroup result;
+      result._cacheLimits = cacheLimits;
+
+      try
+      {
+        //Map file
+        auto preferredPath = path;
+        preferredPath.make_preferred();
+        result._file = mapped_file(preferredPath);
+
+        //Check header
+        auto magic = result.ReadRange(0, 4);
+        if (memcmp(magic, "CSG3", 4) == 0)
+        {
+          result._version = 3;
+          result.ReadLegacyIndex();
+        }
+        else if (memcmp(magic, "CSG4", 4) == 0)
+        {
+          result._version = 4;
+          result.ReadIndex();
+        }
+        else
+        {
+          throw std::runtime_error("Invalid compiled shader group file header.");
+        }
+      }
+      catch (...)
+      {
+        throw std::runtime_error("Failed to open compiled shader group file.");
+      }
+
+      //Legacy containers are always LZMS compressed, so they are checked upfront
+      if (result._version == 3 && !result._legacyBlocks.empty()) CheckCodec(BlockCodec::Lzms);
+      return result;
+    }
+
+    //Returns the shaders currently cached
+    std::unordered_map<uint64_t, std::shared_ptr<const CompiledShader>> Shaders() const
+    {
+      std::shared_lock lock(*_shaderMutex);
+
+      std::unordered_map<uint64_t, std::shared_ptr<const CompiledShader>> result;
+      for (auto& page : _shaderPages)
+      {
+        if (!page) continue;
+
+        for (auto& entry : page->Shaders)
+        {
+          if (entry.Shader) result[entry.Shader->Key] = entry.Shader;
+        }
+      }
+
+      return result;
+    }
+
+    //Returns the keys of every shader in the group, legacy containers are decompressed to find them
+    std::vector<uint64_t> Keys() const
+    {
+      std::vector<uint64_t> result;
+      if (_version == 4)
+      {
+        result.reserve(_shaderCount);
+        for (uint32_t i = 0; i < _shaderCount; ++i)
+        {
+          result.push_back(ReadValue<uint64_t>(_aliasTableOffset + size_t(i) * AliasEntrySize));
+        }
+      }
+      else if (_version == 3)
+      {
+        for (auto& [blockKey, blockInfo] : _legacyBlocks)
+        {
+          auto block = DecompressBlock(blockInfo);
+          result.insert(result.end(), block.RecordKeys.begin(), block.RecordKeys.end());
+        }
+        std::sort(result.begin(), result.end());
+      }
+      else
+      {
+        result = _memoryKeys;
+      }
+
+      return result;
+    }
+
+    //Returns the shader or null if the key is not found, the shader stays valid while referenced even after it is evicted from the cache
+    //Throws CompiledShaderCodecError if the shader is compressed with a codec this build cannot decode
+    //Safe to call from multiple threads, cached shaders are returned under a shared lock and different blocks are decompressed in parallel
+    std::shared_ptr<const CompiledShader> Shader(uint64_t key)
+    {
+      std::shared_ptr<const ShaderBlock> block;
+      return FindShader(key, block);
+    }
+
+    template<typename T>
+    std::shared_ptr<const CompiledShader> Shader(T key)
+    {
+      return Shader(uint64_t(key));
+    }
+
+    //Returns the shaders of the keys in the same order, null where a key is not found, codec errors are thrown as by Shader
+    //The keys are grouped by block, so each block is decompressed once, blocks are loaded in parallel by the calling thread and the load pool
+    std::vector<std::shared_ptr<const CompiledShader>> Shaders(std::span<const uint64_t> keys)
+    {
+      struct batch_state
+      {
+        std::vector<std::shared_ptr<const CompiledShader>> Results;
+        std::vector<std::vector<std::pair<size_t, uint64_t>>> Blocks;
+        std::atomic<size_t> NextBlock = 0;
+
+        std::mutex Mutex;
+        std::condition_variable Completed;
+        size_t CompletedCount = 0;
+        std::exception_ptr Error;
+      };
+
+      auto state = std::make_shared<batch_state>();
+      state->Results.resize(keys.size());
+
+      //Take the cached shaders and group the rest by block
+      {
+        std::unordered_map<uint64_t, size_t> blockIndices;
+
+        std::shared_lock lock(*_shaderMutex);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+          state->Results[i] = GetCachedShader(FindSlot(keys[i]));
+          if (state->Results[i]) continue;
+
+          auto blockKey = FindBlockKey(keys[i]);
+          if (!blockKey) continue;
+
+          auto [blockIndex, isAdded] = blockIndices.try_emplace(*blockKey, state->Blocks.size());
+          if (isAdded) state->Blocks.emplace_back();
+          state->Blocks[blockIndex->second].emplace_back(i, keys[i]);
+        }
+      }
+
+      if (state->Blocks.empty()) return std::move(state->Results);
+
+      //Both the pool and the calling thread take blocks until none are left, so the batch completes even if the pool is busy
+      auto loadBlocks = [this](batch_state& state) {
+        for (auto i = state.NextBlock++; i < state.Blocks.size(); i = state.NextBlock++)
+        {
+          std::exception_ptr error;
+          try
+          {
+            std::shared_ptr<const ShaderBlock> block;
+            for (auto& [index, key] : state.Blocks[i])
+            {
+              state.Results[index] = FindShader(key, block);
+            }
+          }
+          catch (...)
+          {
+            error = std::current_exception();
+          }
+
+          std::lock_guard lock(state.Mutex);
+          if (error && !state.Error) state.Error = error;
+          if (++state.CompletedCount == state.Blocks.size()) state.Completed.notify_all();
+        }
+      };
+
+      auto helperCount = std::min<size_t>(state->Blocks.size() - 1, std::thread::hardware_concurrency());
+      for (size_t i = 0; i < helperCount; i++)
+      {
+        SubmitLoad([state, loadBlocks] { loadBlocks(*state); });
+      }
+
+      loadBlocks(*state);
+
+      std::unique_lock lock(state->Mutex);
+      state->Completed.wait(lock, [&] { return state->CompletedCount == state->Blocks.size(); });
+      if (state->Error) std::rethrow_exception(state->Error);
+      return std::move(state->Results);
+    }
+
+    //Loads the shader on a background thread, the result is null if the key is not found, cached shaders complete immediately
+    std::future<std::shared_ptr<const CompiledShader>> ShaderAsync(uint64_t key)
+    {
+      auto promise = std::make_shared<std::promise<std::shared_ptr<const CompiledShader>>>();
+      auto result = promise->get_future();
+
+      {
+        std::shared_lock lock(*_shaderMutex);
+
+        auto cachedShader = GetCachedShader(FindSlot(key));
+        if (cachedShader)
+        {
+          promise->set_value(cachedShader);
+          return result;
+        }
+      }
+
+      SubmitLoad([this, key, promise] {
+        try
+        {
+          promise->set_value(Shader(key));
+        }
+        catch (...)
+        {
+          promise->set_exception(std::current_exception());
+        }
+      });
+
+      return result;
+    }
+
+    template<typename T>
+    std::future<std::shared_ptr<const CompiledShader>> ShaderAsync(T key)
+    {
+      return ShaderAsync(uint64_t(key));
+    }
+
+    //Loads the shaders into the cache on background threads without blocking the caller, the future completes once all of them are loaded
+    //The future holds the codec error if a shader cannot be decoded by this build
+    //Each block is loaded by a single task, so it is decompressed once and different blocks are decompressed in parallel
+    std::future<void> Prefetch(std::span<const uint64_t> keys)
+    {
+      //Group the keys by block, cached and unknown keys are skipped
+      std::unordered_map<uint64_t, std::vector<uint64_t>> blockKeys;
+      {
+        std::shared_lock lock(*_shaderMutex);
+        for (auto key : keys)
+        {
+          if (GetCachedShader(FindSlot(key))) continue;
+
+          auto blockKey = FindBlockKey(key);
+          if (blockKey) blockKeys[*blockKey].push_back(key);
+        }
+      }
+
+      struct prefetch_state
+      {
+        std::atomic<size_t> Remaining;
+        std::promise<void> Completed;
+
+        std::mutex Mutex;
+        std::exception_ptr Error;
+      };
+
+      auto state = std::make_shared<prefetch_state>();
+      auto result = state->Completed.get_future();
+      if (blockKeys.empty())
+      {
+        state->Completed.set_value();
+        return result;
+      }
+
+      state->Remaining = blockKeys.size();
+      for (auto& [blockKey, shaderKeys] : blockKeys)
+      {
+        SubmitLoad([this, state, shaderKeys = std::move(shaderKeys)] {
+          try
+          {
+            std::shared_ptr<const ShaderBlock> block;
+            for (auto key : shaderKeys)
+            {
+              FindShader(key, block);
+            }
+          }
+          catch (...)
+          {
+            std::lock_guard lock(state->Mutex);
+            if (!state->Error) state->Error = std::current_exception();
+          }
+
+          if (--state->Remaining > 0) return;
+
+          std::lock_guard lock(state->Mutex);
+          if (state->Error) state->Completed.set_exception(state->Error);
+          else state->Completed.set_value();
+        });
+      }
+
+      return result;
+    }
+
+    //Changes the cache limits, evicting blocks and shaders as needed
+    void CacheLimits(const CompiledShaderCacheLimits& limits)
+    {
+      std::unique_lock lock(*_shaderMutex);
+      std::lock_guard blockLock(*_blockMutex);
+
+      _cacheLimits = limits;
+      while (_blockCache.size() > std::max<size_t>(_cacheLimits.BlockCount, 1))
+      {
+        EvictBlock();
+      }
+      TrimCache();
+    }
+
+    //Number of bytes kept resident by the cached blocks and shaders, a block shared by several of them is counted once
+    size_t CacheSize() const
+    {
+      std::lock_guard blockLock(*_blockMutex);
+      return _residentSize;
+    }
+
+    void ClearCache()
+    {
+      std::unique_lock lock(*_shaderMutex);
+      std::lock_guard blockLock(*_blockMutex);
+
+      //Shaders not loaded from the file cannot be reloaded, so they are kept
+      if (_version) _shaderPages.clear();
+
+      _shaderOrder.clear();
+      _loadedBlobs.clear();
+
+      //Blocks being loaded are not counted once they finish
+      _blockCache.clear();
+      _blockOrder.clear();
+      _residentBuffers.clear();
+      _residentSize = 0;
     }
   };
-}
\ No newline at end of file
+}